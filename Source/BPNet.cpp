@@ -1,30 +1,62 @@
 #include <stdio.h>
 #include <math.h>
+#include <memory.h>
 #include "BPNet.h"
 
+void BPTrainer::Backpropagate(Neuron *neuron, double errorfactor)
+{
+  forEach(InputSynapse, (neuron->inputs), inputsynapse) {
+    // the error goes back through the weight as it was before this step
+    Neuron *source = inputsynapse->GetConnectedNeuron();
+    if(source != null)
+      source->TempDouble() += errorfactor * inputsynapse->weight;
+
+    double data = inputsynapse->GetConnectedData();
+    double weightdelta = step * errorfactor * data;
+    inputsynapse->weight += weightdelta;
+  }
+}
+
 double BPTrainer::Train(LayeredNet *net, int state)
 {
+  const double *inputs, *targets;
+  GetSample(state, inputs, targets);
+  return Train(net, inputs, targets);
+}
+
+double BPTrainer::Train(LayeredNet *net, const double *inputs, const double *targets)
+{
+  // the net needs the weights of the batches trained before and the compiled copy
+  // needs the ones changed here, bound parameters stay as they are
+  if(net == compilednet) {
+    if(pending) compiled.Store(net);
+    pending = false;
+    reload = true;
+  }
+
   Container *outputs = net->GetOutputs();
-  input(inputbuffer, state); // generate the given state (the state parameter may be ignored by the network)
+  net->Update(inputs, outputbuffer2);
+
+  // the hidden neurons collect the errors of the neurons they feed in TempDouble
+  for(Layer *layer = (Layer *)net->GetInputLayer()->Next(); layer != net->GetOutputLayer(); layer = (Layer *)layer->Next()) {
+    forEach(Neuron, layer->neurons, neuron)
+      neuron->TempDouble() = 0.0;
+  }
 
-  train(inputbuffer, outputbuffer1);
-  net->Update(inputbuffer, outputbuffer2);
+  // the cross-entropy of a softmax layer has no derivative to multiply by
+  bool softmax = net->GetOutputLayer()->IsSoftmax();
 
   double meanerror = 0.0;
   // set the output layer errors and input weights
   int i = 0;
   forEach(Neuron, (*outputs), neuron) {
-    double desiredoutput = outputbuffer1[i];
+    double desiredoutput = targets[i];
     double actualoutput = outputbuffer2[i]; // == neuron->GetData();
 
-    double errorfactor = actualoutput * (1 - actualoutput) * (desiredoutput - actualoutput);
-    neuron->TempDouble() = errorfactor; // store error factor in temp
-
-    forEach(InputSynapse, (neuron->inputs), inputsynapse) {
-      double data = inputsynapse->GetConnectedData();
-      double weightdelta = step * errorfactor * data;
-      inputsynapse->temp = inputsynapse->weight + weightdelta;
-    }
+    double errorfactor = desiredoutput - actualoutput;
+    if(!softmax)
+      errorfactor *= Neuron::GetDerivative(neuron->GetTransferFunction(), actualoutput);
+    Backpropagate(neuron, errorfactor);
 
     meanerror += fabs(desiredoutput - actualoutput);
     i ++;
@@ -32,32 +64,326 @@ double BPTrainer::Train(LayeredNet *net, int state)
 
   meanerror /= (double)i;
 
-  // process the other layers
+  // process the other layers, by now every neuron in a layer has all of its errors
+  // since the layers after it have been processed
   for(Layer *layer = (Layer *)net->GetOutputLayer()->Prev(); layer != net->GetInputLayer(); layer = (Layer *)layer->Prev()) {
-    
-    //printf("%d", layer->neurons.GetSize());
-
     forEach(Neuron, layer->neurons, neuron) {
-      double errorfactor = 0;
-
-      // GetConnectedNeuron()->GetTemp() returns the error factor of the neuron in the next layer
-      forEach(OutputSynapse, neuron->outputs, outputsynapse)
-        errorfactor += outputsynapse->GetConnectedNeuron()->TempDouble() * outputsynapse->GetWeight(); 
-      
       double data = neuron->Data();
-      errorfactor *= data * (1 - data);
-      neuron->TempDouble() = errorfactor;
+      double errorfactor = neuron->TempDouble() * Neuron::GetDerivative(neuron->GetTransferFunction(), data);
+      Backpropagate(neuron, errorfactor);
+    }
+  }
+
+  return meanerror;
+}
+
+BPTrainer::BPTrainer(int inputcount, int outputcount) : NetTrainer(inputcount, outputcount),
+  compilednet(null), compiledversion(-1), pending(false), reload(false), boundparams(null), pool(null), asynchronous(false),
+  workers(null), workercount(0), workererrors(null), optimizer(null)
+{
+}
+
+BPTrainer::~BPTrainer()
+{
+  safe_delete_array(workers);
+  safe_delete_array(workererrors);
+}
+
+void BPTrainer::SetThreadPool(ThreadPool *p, bool async)
+{
+  pool = p;
+  asynchronous = async;
+
+  // the compiled net stays as it is, CompileNet makes new workers for the pool
+  safe_delete_array(workers);
+  safe_delete_array(workererrors);
+  workercount = 0;
+}
+
+void BPTrainer::Bind(double *params)
+{
+  boundparams = params;
+  Invalidate();
+}
+
+bool BPTrainer::StoreWeights(LayeredNet *net)
+{
+  if(!CompileNet(net) || !compiled.Store(net))
+    return false;
+
+  pending = false;
+  return true;
+}
+
+bool BPTrainer::CompileNet(LayeredNet *net)
+{
+  // the weights changed by Train are reloaded unless the parameters are bound
+  // the workers share the parameters, so they get the reloaded weights as well
+  if(net != compilednet || compiledversion != net->GetTopologyVersion() ||
+     (reload && boundparams == null && !compiled.Reload(net))) {
+    compilednet = null;
+    pending = false;
+    safe_delete_array(workers);
+    safe_delete_array(workererrors);
+    workercount = 0;
+
+    if(!compiled.Compile(net))
+      return false;
+    if(boundparams != null)
+      compiled.Bind(boundparams);
+
+    compilednet = net;
+    compiledversion = net->GetTopologyVersion();
+  }
+  reload = false;
+
+  if(workers == null && pool != null && pool->GetThreadCount() > 1) {
+    workercount = pool->GetThreadCount();
+    workers = new CompiledNet[workercount];
+    workererrors = new double[workercount];
+    for(int i = 0; i < workercount; i ++)
+      workers[i].Share(&compiled);
+  }
+
+  return true;
+}
+
+// a batch being trained on several threads
+struct TrainTask
+{
+  BPTrainer *trainer;
+  const double *inputs, *targets;
+  double *outputs;
+  int n;
+
+  // the slices of the batch
+  int slices;
+
+  // the gradients of each slice, paramcount apart
+  double *gradients;
+  int paramcount;
+
+  // the distance between the pairs of slices added up at the current level of the reduction
+  int distance;
+
+  // the gradients are added up over the batch, this turns them into the mean
+  double scale;
+};
+
+// the parameters are split into chunks, so that every thread has work to do
+// even at the top of the reduction tree, where only one pair of slices is left
+static void GetChunk(TrainTask *task, int index, int count, int &first, int &last)
+{
+  first = (int)((long long)task->paramcount * index / count);
+  last = (int)((long long)task->paramcount * (index + 1) / count);
+}
+
+void BPTrainer::BatchTask(void *param, int index, int count)
+{
+  TrainTask *task = (TrainTask *)param;
+  BPTrainer *trainer = task->trainer;
+  CompiledNet *worker = &trainer->workers[index];
+
+  int r0 = (int)((long long)task->n * index / count);
+  int r1 = (int)((long long)task->n * (index + 1) / count);
+  int rows = r1 - r0, inputcount = trainer->inputcount, outputcount = trainer->outputcount;
 
-      forEach(InputSynapse, (neuron->inputs), inputsynapse) {
-        double data = inputsynapse->GetConnectedData();
-        double weightdelta = step * errorfactor * data;
-        inputsynapse->temp = inputsynapse->weight + weightdelta;
+  const double *targets = task->targets + (size_t)r0 * outputcount;
+  double *outputs = task->outputs + (size_t)r0 * outputcount;
+  worker->UpdateBatch(task->inputs + (size_t)r0 * inputcount, rows, outputs);
+
+  double error = 0.0;
+  for(size_t i = 0; i < (size_t)rows * outputcount; i ++)
+    error += fabs(targets[i] - outputs[i]);
+  trainer->workererrors[index] = error;
+
+  double *gradient = task->gradients + (size_t)index * task->paramcount;
+  memset(gradient, 0, task->paramcount * sizeof(double));
+  worker->Backpropagate(targets, rows, gradient);
+
+  if(trainer->IsHogwild()) {
+    // the weights are shared by all the threads and changed without locking
+    // only the weights with a gradient are written to, so that the threads
+    // don't fight over cache lines they don't need to
+    double *params = trainer->compiled.GetParameters();
+    double rate = trainer->step * task->scale;
+    for(int i = 0; i < task->paramcount; i ++) {
+      if(gradient[i] != 0.0)
+        params[i] -= rate * gradient[i];
+    }
+  }
+}
+
+void BPTrainer::ReduceTask(void *param, int index, int count)
+{
+  TrainTask *task = (TrainTask *)param;
+
+  // each pair of slices at this level is split into the same number of chunks
+  int pairs = (task->slices + 2 * task->distance - 1) / (2 * task->distance);
+  int chunks = count / pairs;
+  int pair = index / chunks, chunk = index % chunks;
+
+  int target = pair * 2 * task->distance, source = target + task->distance;
+  if(source >= task->slices) return;
+
+  int first, last;
+  GetChunk(task, chunk, chunks, first, last);
+
+  double *a = task->gradients + (size_t)target * task->paramcount;
+  double *b = task->gradients + (size_t)source * task->paramcount;
+  for(int i = first; i < last; i ++)
+    a[i] += b[i];
+}
+
+void BPTrainer::StepTask(void *param, int index, int count)
+{
+  TrainTask *task = (TrainTask *)param;
+
+  int first, last;
+  GetChunk(task, index, count, first, last);
+
+  task->trainer->ApplyGradients(task->gradients, first, last, task->scale);
+}
+
+void BPTrainer::ApplyGradients(const double *gradient, int first, int last, double scale)
+{
+  double *params = compiled.GetParameters();
+
+  if(optimizer != null) {
+    optimizer->Update(params, gradient, first, last, step, scale);
+  } else {
+    double rate = step * scale;
+    for(int i = first; i < last; i ++)
+      params[i] -= rate * gradient[i];
+  }
+}
+
+double BPTrainer::TrainBatch(LayeredNet *net, const int *states, int n)
+{
+  if(!CompileNet(net)) {
+    double meanerror = 0.0;
+    for(int r = 0; r < n; r ++)
+      meanerror += Train(net, states[r]);
+    return meanerror / (double)n;
+  }
+
+  // batches of consecutive samples are used where they are in the dataset
+  const double *inputs, *targets;
+  GetSamples(states, n, (double *)batchinputs.GetBuffer((size_t)n * inputcount * sizeof(double)),
+    (double *)batchtargets.GetBuffer((size_t)n * outputcount * sizeof(double)), inputs, targets);
+  return TrainBatch(net, inputs, targets, n);
+}
+
+double BPTrainer::TrainBatch(LayeredNet *net, const double *inputs, const double *targets, int n)
+{
+  if(!CompileNet(net)) {
+    double meanerror = 0.0;
+    for(int r = 0; r < n; r ++)
+      meanerror += Train(net, inputs + (size_t)r * inputcount, targets + (size_t)r * outputcount);
+    return meanerror / (double)n;
+  }
+
+  double *outputs = (double *)batchoutputs.GetBuffer((size_t)n * outputcount * sizeof(double));
+
+  if(workercount > 1 && n > 1) {
+    TrainTask task;
+    task.trainer = this;
+    task.inputs = inputs;
+    task.targets = targets;
+    task.outputs = outputs;
+    task.n = n;
+    task.slices = min(workercount, n);
+    task.paramcount = compiled.GetParameterCount();
+    task.gradients = (double *)gradients.GetBuffer((size_t)task.slices * task.paramcount * sizeof(double));
+    task.scale = 1.0 / (double)n;
+
+    if(optimizer != null)
+      optimizer->Prepare(task.paramcount);
+
+    pool->Run(BatchTask, &task, task.slices);
+
+    if(!IsHogwild()) {
+      // add the gradients up in pairs, then pairs of pairs and so on
+      int threads = pool->GetThreadCount();
+      for(task.distance = 1; task.distance < task.slices; task.distance *= 2) {
+        int pairs = (task.slices + 2 * task.distance - 1) / (2 * task.distance);
+        pool->Run(ReduceTask, &task, pairs * max(1, threads / pairs));
       }
+
+      pool->Run(StepTask, &task, threads);
     }
 
+    double meanerror = 0.0;
+    for(int i = 0; i < task.slices; i ++)
+      meanerror += workererrors[i];
+
+    pending = boundparams == null;
+    return meanerror / ((double)n * outputcount);
   }
 
-  // set the new weights
-  net->SetWeights(null); //TODO move to NeuralNet::Reset, so we don't have to cycle twice
+  compiled.UpdateBatch(inputs, n, outputs);
+
+  double meanerror = 0.0;
+  for(size_t i = 0; i < (size_t)n * outputcount; i ++)
+    meanerror += fabs(targets[i] - outputs[i]);
+  meanerror /= (double)n * outputcount;
+
+  int paramcount = compiled.GetParameterCount();
+  double *gradient = (double *)gradients.GetBuffer(paramcount * sizeof(double));
+  memset(gradient, 0, paramcount * sizeof(double));
+  compiled.Backpropagate(targets, n, gradient);
+
+  // a single step against the mean gradient of the batch
+  if(optimizer != null)
+    optimizer->Prepare(paramcount);
+  ApplyGradients(gradient, 0, paramcount, 1.0 / (double)n);
+
+  pending = boundparams == null;
   return meanerror;
 }
+
+double BPTrainer::TrainEpoch(LayeredNet *net, int batchsize, bool shuffle)
+{
+  if(dataset == null || dataset->GetSize() == 0) return NetTrainer::TrainError;
+
+  int size = dataset->GetSize();
+  // in order the batches are consecutive samples, which may be used without copying
+  if(order.GetSize() != size || !shuffle)
+    order.Reset(size);
+  if(shuffle)
+    order.Shuffle();
+
+  batchsize = max(1, batchsize);
+
+  // the mean error of the batches is weighted by their sizes, the last one may be smaller
+  double meanerror = 0.0;
+  for(int i = 0; i < size; i += batchsize) {
+    int n = min(batchsize, size - i);
+    meanerror += TrainBatch(net, order.GetIndices(i), n) * (double)n;
+  }
+
+  if(pending) StoreWeights(net);
+  return meanerror / (double)size;
+}
+
+double BPTrainer::TrainEpoch(LayeredNet *net, Prefetcher *prefetcher)
+{
+  if(prefetcher->GetDataset() == null ||
+     prefetcher->GetDataset()->GetInputCount() != inputcount ||
+     prefetcher->GetDataset()->GetTargetCount() != outputcount)
+    return NetTrainer::TrainError;
+
+  double meanerror = 0.0;
+  int count = 0;
+  Prefetcher::Batch *batch;
+  do {
+    batch = prefetcher->Next();
+    if(batch == null) break;
+
+    meanerror += TrainBatch(net, batch->inputs, batch->targets, batch->n) * (double)batch->n;
+    count += batch->n;
+  } while(!batch->last);
+
+  if(pending) StoreWeights(net);
+  return count > 0 ? meanerror / (double)count : NetTrainer::TrainError;
+}
@@ -1,14 +1,73 @@
 #pragma once
 
 #include "NeuralNet.h"
+#include "CompiledNet.h"
+#include "Optimizer.h"
+#include "Dataset.h"
 
 // a simple Back Propagation Net is made up only of layers
 // for a basic introduction see http://www.dontveter.com/bpr/public2.html
+// training is always done in double precision, the precision of the net,
+// see NeuralNet::SetPrecision, only applies to saving it and to UpdateBatch
+// small gradients would get lost in float weights, a net trained here can be
+// switched to Float afterwards to be saved and run at half the size
 class BPTrainer : public NetTrainer
 {
 protected:
   double step;
 
+  // the compiled copy of the net trained by TrainBatch
+  CompiledNet compiled;
+  LayeredNet *compilednet;
+  int compiledversion;
+
+  // pending is true while the compiled weights haven't been stored in the net yet,
+  // reload is true once Train has changed the weights of the net, see CompileNet
+  bool pending, reload;
+
+  // the parameters trained instead of the compiled net's own, see Bind
+  double *boundparams;
+
+  // the inputs, desired outputs and actual outputs of a batch and the gradients
+  MemoryBuffer batchinputs, batchtargets, batchoutputs;
+  MemoryBuffer gradients;
+
+  // the pool spreading each batch over several threads, see SetThreadPool
+  ThreadPool *pool;
+  bool asynchronous;
+
+  // one copy of the compiled net for each thread, sharing its weights
+  // each thread has its own slice of the gradients buffer and its own error
+  CompiledNet *workers;
+  int workercount;
+  double *workererrors;
+
+  // the order of the samples in TrainEpoch
+  SampleOrder order;
+
+  // sends the error factor of a neuron back to the neurons feeding it and changes
+  // its weights, both in the same pass over the synapses
+  void Backpropagate(Neuron *neuron, double errorfactor);
+
+  // the optimizer used by TrainBatch, see SetOptimizer
+  Optimizer *optimizer;
+
+  // compiles the net unless it's already compiled, in which case
+  // the weights are reloaded if Train has changed them
+  bool CompileNet(LayeredNet *net);
+
+  // true if the threads change the weights without a reduction, see SetThreadPool
+  inline bool IsHogwild() { return asynchronous && optimizer == null; }
+
+  // changes the compiled parameters first to last - 1 by the gradients times scale
+  // using the optimizer, or plain gradient descent without one
+  void ApplyGradients(const double *gradient, int first, int last, double scale);
+
+  // the tasks run by the pool, they get the TrainTask describing the batch
+  static void BatchTask(void *param, int index, int count);
+  static void ReduceTask(void *param, int index, int count);
+  static void StepTask(void *param, int index, int count);
+
 public:
 
   // this is the step parameter
@@ -18,8 +77,84 @@ public:
   inline double& Step() { return step; }
 
   // train a single net
+  // the error is the squared error, or the cross-entropy for a softmax output layer,
+  // see Layer::SetSoftmax, the returned error is the mean absolute error
+  // the weights of the net itself are changed, so the weights of earlier batches
+  // are stored first and the next batch reloads the new ones, see TrainBatch
   double Train(LayeredNet *net, int state);
 
+  // trains the net on a single sample, given by its inputs and desired outputs
+  double Train(LayeredNet *net, const double *inputs, const double *targets);
+
+  // trains the net on a mini-batch of n samples, generated from the given states
+  // the gradients of all the samples are added up and the weights are changed once
+  // by step times the mean gradient, so a batch of one sample trains like Train
+  // the net is compiled and the whole batch goes through each layer at once,
+  // forwards and backwards, see CompiledNet::Backpropagate
+  // the trainer keeps the compiled net between batches and only copies the new weights
+  // back to the net at the end of TrainEpoch or when StoreWeights is called, so
+  // StoreWeights has to be called before the net is used after a batch on its own,
+  // before its structure is changed and before another net is trained
+  // Train reloads the weights by itself, call Invalidate if they are changed in some other way
+  // nets that can't be compiled are trained one sample at a time
+  // returns the mean error of the batch
+  double TrainBatch(LayeredNet *net, const int *states, int n);
+
+  // the same for a batch of n samples given by their inputs and desired outputs,
+  // one sample after the other
+  double TrainBatch(LayeredNet *net, const double *inputs, const double *targets, int n);
+
+  // trains the net on every sample of the dataset once, see SetDataset,
+  // in batches of batchsize samples, see TrainBatch, the net gets the new weights at the end
+  // the samples are visited in a new random order each time, unless shuffle is false
+  // returns the mean error of the epoch
+  double TrainEpoch(LayeredNet *net, int batchsize, bool shuffle = true);
+
+  // the same with the batches of a prefetcher, which are got ready on another thread
+  // while the previous ones are trained, see Prefetcher
+  // the epoch ends with the last batch of the prefetcher's current epoch, so the first
+  // call after Prefetcher::Start trains on every sample once, like the other TrainEpoch
+  double TrainEpoch(LayeredNet *net, Prefetcher *prefetcher);
+
+  // makes the next TrainBatch compile the net again, weights that haven't been stored are lost
+  inline void Invalidate() { compilednet = null; pending = false; }
+
+  // spreads the batches of TrainBatch over the threads of the pool
+  // each thread runs its slice of the batch forwards and backwards into its own
+  // gradients, which are then added up in a tree, in parallel over the weights
+  // in asynchronous mode there is no reduction, instead each thread changes the
+  // shared weights by its own gradients as soon as it has them, without locking,
+  // while the other threads may still be reading them (known as Hogwild)
+  // this scales better, especially when most of the gradients are zero, but
+  // the results depend on the timing of the threads
+  // with an optimizer the gradients are always added up first, since its state,
+  // like the momentum and the step count, can't be changed by several threads at once
+  // a null pool trains on the calling thread, which is the default
+  void SetThreadPool(ThreadPool *pool, bool asynchronous = false);
+  inline ThreadPool* GetThreadPool() { return pool; }
+
+  // sets the optimizer that changes the weights in TrainBatch, by default
+  // or with a null optimizer it's plain gradient descent with the step as rate
+  // the optimizer isn't owned by the trainer, its state belongs to one net
+  // so it should be reset, see Optimizer::Reset, before training another one
+  // it turns off the asynchronous mode of SetThreadPool
+  inline void SetOptimizer(Optimizer *optimizer) { this->optimizer = optimizer; }
+  inline Optimizer* GetOptimizer() { return optimizer; }
+
+  // makes TrainBatch train the parameters in params instead of a copy of the net's weights,
+  // they're laid out like the parameters of the compiled net, see CompiledNet::GetParameters,
+  // a chromosome of a GATrainer for instance, see GATrainer::IsBound
+  // the weights aren't copied back to the net after each batch then, a batch only
+  // changes the parameters, the net gets them when StoreWeights is called
+  // params has to stay valid as long as it's bound, null goes back to the net's weights
+  // the net is compiled again, so call StoreWeights first to keep the weights of earlier batches
+  void Bind(double *params);
+
+  // copies the weights trained by TrainBatch, or the bound parameters, to the net
+  // returns false if it can't be compiled
+  bool StoreWeights(LayeredNet *net);
+
   // creates a trainer
-  BPTrainer(int inputcount, int outputcount) : NetTrainer(inputcount, outputcount) {}
+  BPTrainer(int inputcount, int outputcount);
+  ~BPTrainer();
 };
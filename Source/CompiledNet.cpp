@@ -0,0 +1,619 @@
+#include <stdlib.h>
+#include <memory.h>
+#include "CompiledNet.h"
+#include "Kernels.h"
+
+template<class real> CompiledNetT<real>::CompiledNetT() : stages(null), stagecount(0), blocks(null), blockcount(0),
+  params(null), paramcount(0), sharedparams(false), datacount(0), batchinputs(null), transfers(null),
+  pool(null), threshold(DefaultThreshold)
+{
+}
+
+template<class real> CompiledNetT<real>::~CompiledNetT()
+{
+  Clear();
+}
+
+template<class real> void CompiledNetT<real>::Clear()
+{
+  safe_delete_array(stages);
+  safe_delete_array(blocks);
+  if(sharedparams)
+    params = null;
+  else
+    safe_delete_array(params);
+  sharedparams = false;
+  safe_delete_array(transfers);
+  batch.Clear();
+  deltabuffer.Clear();
+  transposebuffer[0].Clear();
+  transposebuffer[1].Clear();
+  stagecount = blockcount = paramcount = datacount = 0;
+}
+
+template<class real> void CompiledNetT<real>::Share(CompiledNetT *source)
+{
+  Clear();
+  if(source->stagecount == 0) return;
+
+  stagecount = source->stagecount;
+  blockcount = source->blockcount;
+  paramcount = source->paramcount;
+  datacount = source->datacount;
+
+  stages = new Stage[stagecount];
+  memcpy(stages, source->stages, stagecount * sizeof(Stage));
+  blocks = new Block[blockcount];
+  memcpy(blocks, source->blocks, blockcount * sizeof(Block));
+  transfers = new TRANSFERFUNCTION[datacount];
+  memcpy(transfers, source->transfers, datacount * sizeof(TRANSFERFUNCTION));
+
+  Bind(source->params);
+}
+
+template<class real> void CompiledNetT<real>::Bind(real *p)
+{
+  if(!sharedparams)
+    safe_delete_array(params);
+  params = p;
+  sharedparams = true;
+}
+
+// returns the kernel for one of the built in transfer functions
+// and -1 for any other function
+static int GetTransferKernel(TRANSFERFUNCTION transfer)
+{
+  if(transfer == Neuron::LinearTransfer) return Kernels::Linear;
+  if(transfer == Neuron::StepTransfer) return Kernels::Step;
+  if(transfer == Neuron::SigmoidTransfer) return Kernels::Sigmoid;
+  if(transfer == Neuron::TanhTransfer) return Kernels::Tanh;
+  if(transfer == Neuron::ReluTransfer) return Kernels::Relu;
+  return -1;
+}
+
+template<class real> bool CompiledNetT<real>::Compile(NeuralNet *net)
+{
+  Clear();
+
+  ::Container *groups = net->GetGroups();
+  int groupcount = groups->GetSize();
+
+  // the input layer has to come first and the output layer last
+  if(groupcount < 2 || groups->Elements() != net->GetInputLayer() ||
+    net->GetOutputLayer()->Next() != null)
+    return false;
+
+  // only layers can be compiled, their input and output neurons are the same
+  forEach(Group, (*groups), group) {
+    if(group->GetInputs() != group->GetOutputs())
+      return false;
+    datacount += group->GetOutputs()->GetSize();
+  }
+
+  stagecount = groupcount;
+  stages = new Stage[stagecount];
+  transfers = new TRANSFERFUNCTION[datacount];
+
+  // number the neurons, TempInt is set to the index of the neuron data
+  Neuron **neurons = new Neuron*[datacount];
+  int *stageof = new int[datacount];
+
+  int s = 0, index = 0;
+  forEach(Group, (*groups), group) {
+    Stage *stage = &stages[s];
+    stage->size = group->GetOutputs()->GetSize();
+    stage->data = index;
+    stage->bias = 0;
+    stage->firstblock = stage->blockcount = 0;
+    stage->transfer = null;
+
+    forEach(Neuron, (*group->GetOutputs()), neuron) {
+      neuron->TempInt() = index;
+      neurons[index] = neuron;
+      stageof[index] = s;
+      transfers[index] = neuron->GetTransferFunction();
+
+      if(neuron == group->GetOutputs()->Elements() || stage->transfer == transfers[index])
+        stage->transfer = transfers[index];
+      else
+        stage->transfer = null;
+      index ++;
+    }
+    stage->kernel = GetTransferKernel(stage->transfer);
+    stage->softmax = group == net->GetOutputLayer() && net->GetOutputLayer()->IsSoftmax();
+    s ++;
+  }
+
+  // find out which layers are connected to which
+  // blockof[s * stagecount + k] is the index of the block connecting stage k to stage s
+  int *blockof = new int[stagecount * stagecount];
+  for(int i = 0; i < stagecount * stagecount; i ++)
+    blockof[i] = -1;
+
+  bool valid = true;
+  for(int i = stages[1].data; i < datacount && valid; i ++) {
+    s = stageof[i];
+    forEach(InputSynapse, neurons[i]->inputs, input) {
+      Neuron *source = input->GetConnectedNeuron();
+      if(source == null) continue; // bias
+
+      // the source has to be in this net and in one of the earlier layers
+      int k = source->TempInt();
+      if(k < 0 || k >= datacount || neurons[k] != source || stageof[k] >= s) {
+        valid = false;
+        break;
+      }
+      blockof[s * stagecount + stageof[k]] = 0;
+    }
+  }
+
+  if(valid) {
+    // lay out the parameters, the biases of each layer followed by its weight blocks
+    for(s = 1; s < stagecount; s ++) {
+      Stage *stage = &stages[s];
+      stage->bias = paramcount;
+      paramcount += stage->size;
+
+      stage->firstblock = blockcount;
+      for(int k = 0; k < s; k ++) {
+        if(blockof[s * stagecount + k] != -1) {
+          blockof[s * stagecount + k] = blockcount;
+          stage->blockcount ++;
+          blockcount ++;
+        }
+      }
+    }
+
+    blocks = new Block[blockcount];
+    for(s = 1; s < stagecount; s ++) {
+      for(int k = 0; k < s; k ++) {
+        int b = blockof[s * stagecount + k];
+        if(b != -1) {
+          blocks[b].source = k;
+          blocks[b].weights = paramcount;
+          paramcount += stages[s].size * stages[k].size;
+        }
+      }
+    }
+
+    // copy the weights, missing connections get a zero weight
+    params = new real[paramcount];
+    memset(params, 0, paramcount * sizeof(real));
+
+    for(int i = stages[1].data; i < datacount; i ++) {
+      s = stageof[i];
+      int row = i - stages[s].data;
+
+      forEach(InputSynapse, neurons[i]->inputs, input) {
+        Neuron *source = input->GetConnectedNeuron();
+        if(source == null) {
+          params[stages[s].bias + row] += input->weight;
+        } else {
+          int k = source->TempInt();
+          Stage *sourcestage = &stages[stageof[k]];
+          Block *block = &blocks[blockof[s * stagecount + stageof[k]]];
+          params[block->weights + row * sourcestage->size + k - sourcestage->data] += input->weight;
+        }
+      }
+    }
+  }
+
+  delete[] neurons;
+  delete[] stageof;
+  delete[] blockof;
+
+  if(!valid) {
+    Clear();
+    return false;
+  }
+
+  return true;
+}
+
+template<class real> real* CompiledNetT<real>::GetStageData(Stage *stage, int n)
+{
+  if(stage == stages) return (real *)batchinputs;
+  return (real *)batch.GetBuffer() + (size_t)n * stage->data;
+}
+
+template<class real> void CompiledNetT<real>::SetThreadPool(ThreadPool *p, int t)
+{
+  pool = p;
+  threshold = t;
+}
+
+template<class real> void CompiledNetT<real>::UpdateRange(Stage *stage, int n, int r0, int r1, int j0, int j1)
+{
+  int rows = r1 - r0, columns = j1 - j0;
+  real *out = GetStageData(stage, n) + (size_t)r0 * stage->size + j0;
+  real *bias = params + stage->bias + j0;
+
+  for(int r = 0; r < rows; r ++)
+    memcpy(out + (size_t)r * stage->size, bias, columns * sizeof(real));
+
+  Kernels::Functions<real> &kernels = Kernels::Get(params);
+
+  for(int b = 0; b < stage->blockcount; b ++) {
+    Block *block = &blocks[stage->firstblock + b];
+    Stage *source = &stages[block->source];
+    real *in = GetStageData(source, n) + (size_t)r0 * source->size;
+    real *weights = params + block->weights + j0 * source->size;
+
+    if(rows == 1)
+      kernels.Gemv(weights, columns, source->size, in, out);
+    else
+      kernels.Gemm(in, source->size, rows, source->size, weights, columns, out, stage->size);
+  }
+
+  // whole rows are contiguous and can be processed in one go
+  if(columns == stage->size) {
+    columns *= rows;
+    rows = 1;
+  }
+
+  for(int r = 0; r < rows; r ++, out += stage->size)
+    ApplyTransfer(stage, out, j0, columns);
+}
+
+template<class real> void CompiledNetT<real>::ApplyTransfer(Stage *stage, real *data, int j0, int count)
+{
+  if(stage->kernel != -1) {
+    Kernels::Get(data).Transfer[stage->kernel](data, count);
+  } else if(stage->transfer != null) {
+    for(int j = 0; j < count; j ++)
+      data[j] = stage->transfer(data[j]);
+  } else {
+    TRANSFERFUNCTION *transfer = transfers + stage->data + j0;
+    for(int j = 0; j < count; j ++)
+      data[j] = transfer[j % stage->size](data[j]);
+  }
+}
+
+// the part of a stage updated by each task
+template<class real> struct StageTask
+{
+  CompiledNetT<real> *net;
+  void *stage;
+  int n;
+  bool byrow;   // split the samples of the batch instead of the neurons
+};
+
+template<class real> void CompiledNetT<real>::UpdateStage(Stage *stage, int n)
+{
+  int inputs = 0;
+  for(int b = 0; b < stage->blockcount; b ++)
+    inputs += stages[blocks[stage->firstblock + b].source].size;
+
+  if(pool == null || pool->GetThreadCount() == 1 ||
+    (double)n * stage->size * inputs <= threshold) {
+    UpdateRange(stage, n, 0, n, 0, stage->size);
+  } else {
+    // a large enough batch is split by samples, so that each thread runs
+    // the whole weight matrix over its own rows, otherwise each thread
+    // takes a slice of the neurons and the rows of weights that feed them
+    StageTask<real> task = { this, stage, n, n >= pool->GetThreadCount() };
+    int count = min(pool->GetThreadCount(), task.byrow ? n : (stage->size + 7) / 8);
+    pool->Run(UpdateTask, &task, count);
+  }
+
+  // the softmax needs whole rows, so it's applied once all the neurons are done
+  if(stage->softmax) {
+    real *data = GetStageData(stage, n);
+    for(int r = 0; r < n; r ++)
+      Kernels::Get(data).Softmax(data + (size_t)r * stage->size, stage->size);
+  }
+}
+
+template<class real> void CompiledNetT<real>::UpdateTask(void *param, int index, int count)
+{
+  StageTask<real> *task = (StageTask<real> *)param;
+  Stage *stage = (Stage *)task->stage;
+
+  if(task->byrow) {
+    int r0 = (int)((long long)task->n * index / count);
+    int r1 = (int)((long long)task->n * (index + 1) / count);
+    task->net->UpdateRange(stage, task->n, r0, r1, 0, stage->size);
+  } else {
+    // the slices are multiples of 8 neurons, so that they start on vector boundaries
+    int blocks = (stage->size + 7) / 8;
+    int j0 = min(stage->size, blocks * index / count * 8);
+    int j1 = min(stage->size, blocks * (index + 1) / count * 8);
+    task->net->UpdateRange(stage, task->n, 0, task->n, j0, j1);
+  }
+}
+
+template<class real> bool CompiledNetT<real>::Update(real *inputbuffer, real *outputbuffer)
+{
+  return UpdateBatch(inputbuffer, 1, outputbuffer);
+}
+
+template<class real> bool CompiledNetT<real>::UpdateBatch(const real *inputs, int n, real *outputs)
+{
+  if(stagecount == 0) return false;
+
+  batch.GetBuffer((size_t)n * datacount * sizeof(real));
+  batchinputs = inputs;
+
+  for(int s = 1; s < stagecount; s ++)
+    UpdateStage(&stages[s], n);
+
+  Stage *output = &stages[stagecount - 1];
+  memcpy(outputs, GetStageData(output, n), (size_t)n * output->size * sizeof(real));
+  return true;
+}
+
+template<class real> bool CompiledNetT<real>::Store(NeuralNet *net)
+{
+  ::Container *groups = net->GetGroups();
+  if(stagecount == 0 || groups->GetSize() != stagecount)
+    return false;
+
+  // number the neurons the same way Compile does
+  int s = 0, index = 0;
+  forEach(Group, (*groups), group) {
+    if(group->GetOutputs()->GetSize() != stages[s].size)
+      return false;
+    forEach(Neuron, (*group->GetOutputs()), neuron)
+      neuron->TempInt() = index ++;
+    s ++;
+  }
+
+  // Compile adds up the weights of several synapses between the same two neurons,
+  // the first of them gets the sum back and the others get zero
+  int *seen = new int[datacount];
+  for(int i = 0; i < datacount; i ++)
+    seen[i] = -1;
+
+  s = 0;
+  forEach(Group, (*groups), group) {
+    Stage *stage = &stages[s ++];
+    if(stage == stages) continue;
+
+    int row = 0;
+    forEach(Neuron, (*group->GetOutputs()), neuron) {
+      int i = stage->data + row;
+      bool bias = false;
+
+      forEach(InputSynapse, neuron->inputs, input) {
+        Neuron *source = input->GetConnectedNeuron();
+        if(source == null) {
+          input->weight = bias ? 0.0 : params[stage->bias + row];
+          bias = true;
+          continue;
+        }
+
+        int k = source->TempInt();
+        for(int b = 0; b < stage->blockcount; b ++) {
+          Block *block = &blocks[stage->firstblock + b];
+          Stage *sourcestage = &stages[block->source];
+          if(k >= sourcestage->data && k < sourcestage->data + sourcestage->size) {
+            input->weight = seen[k] == i ? 0.0 : params[block->weights + row * sourcestage->size + k - sourcestage->data];
+            seen[k] = i;
+            break;
+          }
+        }
+      }
+      row ++;
+    }
+  }
+
+  delete[] seen;
+  return true;
+}
+
+template<class real> bool CompiledNetT<real>::Reload(NeuralNet *net)
+{
+  ::Container *groups = net->GetGroups();
+  if(stagecount == 0 || groups->GetSize() != stagecount)
+    return false;
+
+  // number the neurons the same way Compile does and pick up their transfer functions
+  int s = 0, index = 0;
+  forEach(Group, (*groups), group) {
+    Stage *stage = &stages[s];
+    if(group->GetOutputs()->GetSize() != stage->size)
+      return false;
+
+    forEach(Neuron, (*group->GetOutputs()), neuron) {
+      neuron->TempInt() = index;
+      transfers[index] = neuron->GetTransferFunction();
+
+      if(index == stage->data || stage->transfer == transfers[index])
+        stage->transfer = transfers[index];
+      else
+        stage->transfer = null;
+      index ++;
+    }
+    stage->kernel = GetTransferKernel(stage->transfer);
+    stage->softmax = group == net->GetOutputLayer() && net->GetOutputLayer()->IsSoftmax();
+    s ++;
+  }
+
+  // add up the weights like Compile does, missing connections stay zero
+  memset(params, 0, paramcount * sizeof(real));
+
+  s = 0;
+  forEach(Group, (*groups), group) {
+    Stage *stage = &stages[s ++];
+    if(stage == stages) continue;
+
+    int row = 0;
+    forEach(Neuron, (*group->GetOutputs()), neuron) {
+      forEach(InputSynapse, neuron->inputs, input) {
+        Neuron *source = input->GetConnectedNeuron();
+        if(source == null) {
+          params[stage->bias + row] += input->weight;
+          continue;
+        }
+
+        int k = source->TempInt(), b = 0;
+        for(; b < stage->blockcount; b ++) {
+          Block *block = &blocks[stage->firstblock + b];
+          Stage *sourcestage = &stages[block->source];
+          if(k >= sourcestage->data && k < sourcestage->data + sourcestage->size) {
+            params[block->weights + row * sourcestage->size + k - sourcestage->data] += input->weight;
+            break;
+          }
+        }
+
+        // a connection the compiled net doesn't have
+        if(b == stage->blockcount)
+          return false;
+      }
+      row ++;
+    }
+  }
+
+  return true;
+}
+
+template<class real> bool CompiledNetT<real>::GetParameterIndices(NeuralNet *net, int *indices)
+{
+  ::Container *groups = net->GetGroups();
+  if(stagecount == 0 || groups->GetSize() != stagecount)
+    return false;
+
+  // number the neurons the same way Compile does
+  int s = 0, index = 0;
+  forEach(Group, (*groups), group) {
+    if(group->GetOutputs()->GetSize() != stages[s].size)
+      return false;
+    forEach(Neuron, (*group->GetOutputs()), neuron)
+      neuron->TempInt() = index ++;
+    s ++;
+  }
+
+  int i = 0;
+  s = 0;
+  forEach(Group, (*groups), group) {
+    Stage *stage = &stages[s ++];
+
+    int row = 0;
+    forEach(Neuron, (*group->GetOutputs()), neuron) {
+      forEach(InputSynapse, neuron->inputs, input) {
+        Neuron *source = input->GetConnectedNeuron();
+        int place = -1;
+
+        if(stage == stages) {
+          // the input layer isn't compiled
+        } else if(source == null)
+          place = stage->bias + row;
+        else {
+          int k = source->TempInt();
+          for(int b = 0; b < stage->blockcount; b ++) {
+            Block *block = &blocks[stage->firstblock + b];
+            Stage *sourcestage = &stages[block->source];
+            if(k >= sourcestage->data && k < sourcestage->data + sourcestage->size) {
+              place = block->weights + row * sourcestage->size + k - sourcestage->data;
+              break;
+            }
+          }
+        }
+
+        indices[i ++] = place;
+      }
+      row ++;
+    }
+  }
+
+  return true;
+}
+
+template<class real> void CompiledNetT<real>::Transpose(const real *in, int rows, int columns, real *out)
+{
+  // work on tiles that fit in the cache, both for reading and for writing
+  const int tile = 32;
+  for(int r0 = 0; r0 < rows; r0 += tile) {
+    int r1 = min(rows, r0 + tile);
+    for(int c0 = 0; c0 < columns; c0 += tile) {
+      int c1 = min(columns, c0 + tile);
+      for(int r = r0; r < r1; r ++) {
+        for(int c = c0; c < c1; c ++)
+          out[(size_t)c * rows + r] = in[(size_t)r * columns + c];
+      }
+    }
+  }
+}
+
+// returns the derivative of a transfer function given its output
+template<class real> static inline real GetDerivative(int kernel, real y)
+{
+  switch(kernel) {
+    case Kernels::Linear: return 1;
+    case Kernels::Step: return 0;
+    case Kernels::Tanh: return 1 - y * y;
+    case Kernels::Relu: return y > 0 ? 1 : 0;
+  }
+
+  // the sigmoid, also used for functions without a kernel
+  return y * (1 - y);
+}
+
+template<class real> void CompiledNetT<real>::MultiplyDerivatives(Stage *stage, const real *data, real *deltas, int n)
+{
+  if(stage->transfer != null) {
+    int kernel = stage->kernel;
+    if(kernel == Kernels::Linear) return;
+
+    for(size_t i = 0; i < (size_t)n * stage->size; i ++)
+      deltas[i] *= GetDerivative(kernel, data[i]);
+    return;
+  }
+
+  for(int j = 0; j < stage->size; j ++) {
+    int kernel = GetTransferKernel(transfers[stage->data + j]);
+    for(int r = 0; r < n; r ++)
+      deltas[(size_t)r * stage->size + j] *= GetDerivative(kernel, data[(size_t)r * stage->size + j]);
+  }
+}
+
+template<class real> void CompiledNetT<real>::Backpropagate(const real *targets, int n, real *gradients)
+{
+  Kernels::Functions<real> &kernels = Kernels::Get(params);
+  Stage *output = &stages[stagecount - 1];
+
+  // the deltas of the hidden layers are sums over the layers they feed
+  real *deltas = (real *)deltabuffer.GetBuffer((size_t)n * datacount * sizeof(real));
+  memset(deltas + (size_t)n * stages[1].data, 0, (size_t)n * (output->data - stages[1].data) * sizeof(real));
+
+  real *outputs = GetStageData(output, n), *outputdeltas = deltas + (size_t)n * output->data;
+  for(size_t i = 0; i < (size_t)n * output->size; i ++)
+    outputdeltas[i] = outputs[i] - targets[i];
+
+  for(int s = stagecount - 1; s >= 1; s --) {
+    Stage *stage = &stages[s];
+    real *delta = deltas + (size_t)n * stage->data;
+    if(!stage->softmax)
+      MultiplyDerivatives(stage, GetStageData(stage, n), delta, n);
+
+    real *bias = gradients + stage->bias;
+    for(int r = 0; r < n; r ++) {
+      for(int j = 0; j < stage->size; j ++)
+        bias[j] += delta[(size_t)r * stage->size + j];
+    }
+
+    real *deltat = (real *)transposebuffer[0].GetBuffer((size_t)n * stage->size * sizeof(real));
+    Transpose(delta, n, stage->size, deltat);
+
+    for(int b = 0; b < stage->blockcount; b ++) {
+      Block *block = &blocks[stage->firstblock + b];
+      Stage *source = &stages[block->source];
+
+      // the gradients of the weights are the transposed deltas times the source data
+      real *in = GetStageData(source, n);
+      real *transposed = (real *)transposebuffer[1].GetBuffer((size_t)max(n, stage->size) * source->size * sizeof(real));
+      Transpose(in, n, source->size, transposed);
+      kernels.Gemm(deltat, n, stage->size, n, transposed, source->size, gradients + block->weights, source->size);
+
+      // the deltas flow back to the source layer through the weights
+      if(block->source > 0) {
+        Transpose(params + block->weights, stage->size, source->size, transposed);
+        kernels.Gemm(delta, stage->size, n, stage->size, transposed, source->size,
+          deltas + (size_t)n * source->data, source->size);
+      }
+    }
+  }
+}
+
+template class CompiledNetT<double>;
+template class CompiledNetT<float>;
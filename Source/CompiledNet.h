@@ -0,0 +1,208 @@
+#pragma once
+
+#include "NeuralNet.h"
+
+// a compiled net is a flat copy of a layered net that is a lot faster to update
+// Neuron::Update follows the synapse pointers for every single connection,
+// the compiled net stores the weights between each pair of connected layers
+// as one contiguous matrix, the biases of each layer as a vector and
+// the neuron data in preallocated buffers
+// an update then becomes a sequence of dense loops over arrays
+
+// the compiled net is a snapshot, it doesn't follow changes made to the
+// original net, Reload picks up new weights, biases and transfer functions
+// and Compile has to be called again after the structure has changed,
+// which Group::GetTopologyVersion tells
+
+// real is the type of the weights and the neuron data, double or float
+// floats take half the memory and fit twice as many numbers in a vector,
+// see CompiledNet and FloatCompiledNet below
+template<class real> class CompiledNetT
+{
+protected:
+
+  // a stage holds the compiled version of one layer
+  struct Stage
+  {
+    int size;         // number of neurons in the layer
+    int data;         // offset of the neuron data in the data buffer
+    int bias;         // offset of the biases in the parameter buffer
+    int firstblock;   // index of the first weight block feeding this layer
+    int blockcount;   // number of weight blocks feeding this layer
+
+    // the transfer function used by all the neurons in the layer
+    // null if the neurons use different functions, see transfers
+    TRANSFERFUNCTION transfer;
+
+    // the kernel applying the transfer function to the whole layer at once
+    // or -1 if the function doesn't have one, see Kernels::TransferFunction
+    int kernel;
+
+    // true for a softmax output layer, see Layer::SetSoftmax
+    bool softmax;
+  };
+
+  // a block connects all the neurons of a source layer to all the neurons
+  // of a later layer, missing connections simply have a zero weight
+  // the weights are stored row by row, one row for every neuron in the later layer
+  struct Block
+  {
+    int source;       // index of the source stage
+    int weights;      // offset of the weight matrix in the parameter buffer
+  };
+
+  Stage *stages;
+  int stagecount;
+
+  Block *blocks;
+  int blockcount;
+
+  // all the weights and biases
+  real *params;
+  int paramcount;
+
+  // true if the parameters belong to another net or to someone else, see Share and Bind
+  bool sharedparams;
+
+  // the number of neurons in all the layers
+  int datacount;
+
+  // the data of all the neurons for a batch of samples, stage after stage
+  // each stage holds one row for every sample
+  MemoryBuffer batch;
+
+  // the input rows of the batch being updated
+  const real *batchinputs;
+
+  // the transfer function of every neuron, used only by stages
+  // where the neurons don't share the same function
+  TRANSFERFUNCTION *transfers;
+
+  // returns the data of a stage for a batch of n samples
+  real* GetStageData(Stage *stage, int n);
+
+  // the pool running wide stages in parallel, see SetThreadPool
+  ThreadPool *pool;
+  int threshold;
+
+  // updates a single stage for a batch of n samples
+  void UpdateStage(Stage *stage, int n);
+
+  // updates the neurons j0 to j1 - 1 of a stage for the samples r0 to r1 - 1 of the batch
+  void UpdateRange(Stage *stage, int n, int r0, int r1, int j0, int j1);
+
+  // applies the transfer functions of a stage to count neurons starting with neuron j0
+  // when j0 is 0 the data may span several rows of the batch
+  void ApplyTransfer(Stage *stage, real *data, int j0, int count);
+
+  // the task run by the thread pool, updates one part of a stage
+  static void UpdateTask(void *param, int index, int count);
+
+  // the deltas of all the neurons for a batch, laid out like the data, see Backpropagate
+  MemoryBuffer deltabuffer;
+  MemoryBuffer transposebuffer[2];
+
+  // multiplies the deltas of a stage by the derivatives of the transfer functions,
+  // given the outputs of the neurons for a batch of n samples
+  void MultiplyDerivatives(Stage *stage, const real *data, real *deltas, int n);
+
+  // writes the transpose of the rows by columns matrix in to out
+  static void Transpose(const real *in, int rows, int columns, real *out);
+
+public:
+
+  // compiles the net, all the groups in it must be layers
+  // and each layer may only receive connections from the layers before it
+  // returns false if the net can't be compiled
+  bool Compile(NeuralNet *net);
+
+  // frees the compiled data
+  void Clear();
+
+  // makes this net a copy of source that uses the same weights and biases,
+  // but has buffers of its own for the neuron data, so that the two nets can
+  // be updated at the same time on different threads
+  // the weights stay owned by source, which has to outlive the copy
+  void Share(CompiledNetT *source);
+
+  // makes the net use the parameters in params instead of its own, without copying them
+  // they have to be laid out like GetParameters and stay valid as long as they're used
+  // binding is just setting a pointer, so a net can be moved from one set of weights
+  // to another, like the chromosomes of a population, see GATrainer, or a flat vector
+  // of parameters trained by BPTrainer, see BPTrainer::Bind
+  void Bind(real *params);
+
+  inline int GetInputCount() { return stagecount > 0 ? stages[0].size : 0; }
+  inline int GetOutputCount() { return stagecount > 0 ? stages[stagecount - 1].size : 0; }
+
+  // returns the number of layers, including the input and output layers
+  inline int GetLayerCount() { return stagecount; }
+
+  // returns the number of weights and biases
+  inline int GetParameterCount() { return paramcount; }
+
+  // returns the weights and biases
+  inline real* GetParameters() { return params; }
+
+  // the default number of multiply-adds in a stage above which it's split between threads
+  // smaller stages are faster on a single thread, the cost of waking up the threads
+  // and waiting for them would be larger than the time saved
+  enum { DefaultThreshold = 1 << 17 };
+
+  // lets the stages of the net run in parallel on the threads of the pool
+  // only the stages with more than threshold multiply-adds for the batch are split,
+  // a null pool updates everything on the calling thread, which is the default
+  // the pool isn't owned by the net and may be shared by several nets
+  // as long as they are not updated at the same time
+  void SetThreadPool(ThreadPool *pool, int threshold = DefaultThreshold);
+  inline ThreadPool* GetThreadPool() { return pool; }
+
+  // feeds the contents of the inputbuffer to the input neurons
+  // and grabs the output from the output neurons, see NeuralNet::Update
+  bool Update(real *inputbuffer, real *outputbuffer);
+
+  // updates a batch of n samples, inputs holds n rows of input data
+  // and n rows of output data are written to outputs
+  // each layer is processed for the whole batch at once, so every weight
+  // is loaded from memory once per batch instead of once per sample
+  bool UpdateBatch(const real *inputs, int n, real *outputs);
+
+  // adds the gradients of the squared error of the last batch passed to UpdateBatch
+  // to gradients, which is laid out like the parameters, see GetParameters
+  // targets holds n rows of desired outputs, the error is half the sum of the
+  // squared differences between the outputs and the targets
+  // the derivatives of the built in transfer functions are computed from their
+  // outputs, any other function is treated as a sigmoid, like BPTrainer::Train does
+  // for a softmax output layer the error is the cross-entropy instead, minus the sum
+  // of the targets times the logarithms of the outputs, whose gradient with respect
+  // to the sums of the neurons is simply the outputs minus the targets
+  // the deltas of each layer are computed for the whole batch at once, so
+  // everything is done with matrix products
+  void Backpropagate(const real *targets, int n, real *gradients);
+
+  // copies the weights and biases back to the net they were compiled from
+  // the net mustn't have changed its structure in the meantime
+  // returns false if the layers don't match the compiled ones
+  bool Store(NeuralNet *net);
+
+  // copies the current weights, biases and transfer functions of the net it was compiled
+  // from into the compiled net, which is a lot cheaper than compiling it again
+  // it doesn't allocate anything, but still walks all the synapses of the net
+  // the net mustn't have changed its structure in the meantime, see Group::GetTopologyVersion
+  // returns false if the layers or connections don't match the compiled ones
+  bool Reload(NeuralNet *net);
+
+  // writes the place in the parameters of the weight of every synapse of the net to indices,
+  // the synapses are taken layer by layer, neuron by neuron, in the order of their inputs,
+  // which is how GATrainer lays out the genes of a chromosome
+  // several synapses between the same two neurons share a place, as Compile adds them up,
+  // synapses of the input layer have none and get -1
+  // returns false if the layers don't match the compiled ones
+  bool GetParameterIndices(NeuralNet *net, int *indices);
+
+  CompiledNetT();
+  ~CompiledNetT();
+};
+
+typedef CompiledNetT<double> CompiledNet;
+typedef CompiledNetT<float> FloatCompiledNet;
@@ -0,0 +1,389 @@
+#include <stdlib.h>
+#include <memory.h>
+#include <float.h>
+#include "CsvConverter.h"
+
+CsvConverter::CsvConverter() : separator(','), header(false), scale(true), columns(null),
+  inputcount(0), targetcount(0), columnmap(null), columncount(0), pool(null),
+  minimums(null), maximums(null), rowcount(0), errorcount(0), dataset(null)
+{
+}
+
+CsvConverter::~CsvConverter()
+{
+  safe_delete_array(columns);
+  safe_delete_array(columnmap);
+  safe_delete_array(minimums);
+  safe_delete_array(maximums);
+}
+
+void CsvConverter::SetColumns(const int *inputcolumns, int in, const int *targetcolumns, int out)
+{
+  safe_delete_array(columns);
+  inputcount = in;
+  targetcount = out;
+
+  if(inputcount + targetcount > 0) {
+    columns = new int[inputcount + targetcount];
+    memcpy(columns, inputcolumns, inputcount * sizeof(int));
+    memcpy(columns + inputcount, targetcolumns, targetcount * sizeof(int));
+  }
+}
+
+// returns the end of the line starting at text, without the line break,
+// and sets next to the start of the next line
+static const char* FindLineEnd(const char *text, const char *end, const char *&next)
+{
+  const char *lineend = (const char *)memchr(text, '\n', end - text);
+  if(lineend == null) {
+    lineend = next = end;
+  } else
+    next = lineend + 1;
+
+  if(lineend > text && lineend[-1] == '\r') lineend --;
+  return lineend;
+}
+
+static bool IsBlank(const char *text, const char *end)
+{
+  for(; text < end; text ++) {
+    if(*text != ' ' && *text != '\t') return false;
+  }
+  return true;
+}
+
+// the powers of ten that are exact in a double
+static const double PowersOfTen[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+  1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+bool CsvConverter::ParseNumber(const char *text, const char *end, double &value)
+{
+  while(text < end && (*text == ' ' || *text == '\t')) text ++;
+  while(end > text && (end[-1] == ' ' || end[-1] == '\t')) end --;
+  if(text == end) return false;
+
+  const char *p = text;
+  bool negative = *p == '-';
+  if(*p == '-' || *p == '+') p ++;
+
+  // the significant digits are collected in an integer, the rest goes into the exponent
+  unsigned long long mantissa = 0;
+  int digits = 0, exponent = 0;
+  bool any = false;
+
+  for(; p < end && *p >= '0' && *p <= '9'; p ++) {
+    if(digits < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      if(mantissa != 0) digits ++;
+    } else
+      exponent ++;
+    any = true;
+  }
+
+  if(p < end && *p == '.') {
+    for(p ++; p < end && *p >= '0' && *p <= '9'; p ++) {
+      if(digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        if(mantissa != 0) digits ++;
+        exponent --;
+      }
+      any = true;
+    }
+  }
+
+  if(any && p < end && (*p == 'e' || *p == 'E')) {
+    p ++;
+    bool negativeexponent = p < end && *p == '-';
+    if(p < end && (*p == '-' || *p == '+')) p ++;
+
+    if(p == end || *p < '0' || *p > '9') return false;
+
+    int e = 0;
+    for(; p < end && *p >= '0' && *p <= '9'; p ++)
+      if(e < 100000) e = e * 10 + (*p - '0');
+    exponent += negativeexponent ? -e : e;
+  }
+
+  // up to 15 digits and a power of ten that are both exact give a correctly rounded result
+  if(any && p == end && digits <= 15 && exponent >= -22 && exponent <= 22) {
+    value = (double)mantissa;
+    value = exponent < 0 ? value / PowersOfTen[-exponent] : value * PowersOfTen[exponent];
+    if(negative) value = -value;
+    return true;
+  }
+
+  // everything else, long numbers, infinities and so on are left to strtod
+  char buffer[128];
+  int length = (int)(end - text);
+  if(length >= (int)sizeof(buffer)) return false;
+
+  memcpy(buffer, text, length);
+  buffer[length] = 0;
+  char *stop;
+  value = strtod(buffer, &stop);
+  return stop == buffer + length;
+}
+
+bool CsvConverter::MapColumns(const char *text, const char *end)
+{
+  // by default every column but the last is an input and the last is the target
+  if(inputcount + targetcount == 0) {
+    int count = 1;
+    for(const char *p = text; p < end; p ++)
+      if(*p == separator) count ++;
+    if(count < 2) return false;
+
+    int *in = new int[count];
+    for(int i = 0; i < count; i ++)
+      in[i] = i;
+    SetColumns(in, count - 1, in + count - 1, 1);
+    delete[] in;
+  }
+
+  columncount = 0;
+  for(int i = 0; i < inputcount + targetcount; i ++) {
+    if(columns[i] < 0) return false;
+    columncount = max(columncount, columns[i] + 1);
+  }
+
+  safe_delete_array(columnmap);
+  columnmap = new int[columncount];
+  for(int i = 0; i < columncount; i ++)
+    columnmap[i] = -1;
+  for(int i = 0; i < inputcount + targetcount; i ++)
+    columnmap[columns[i]] = i;
+
+  return inputcount > 0;
+}
+
+int CsvConverter::ParseLine(const char *text, const char *end, double *sample, bool *parsed)
+{
+  int count = inputcount + targetcount;
+  memset(sample, 0, count * sizeof(double));
+  if(parsed != null) memset(parsed, 0, count * sizeof(bool));
+
+  int found = 0;
+  const char *field = text;
+  for(int column = 0; column < columncount; column ++) {
+    const char *fieldend = (const char *)memchr(field, separator, end - field);
+    if(fieldend == null) fieldend = end;
+
+    int i = columnmap[column];
+    if(i >= 0 && ParseNumber(field, fieldend, sample[i])) {
+      if(parsed != null) parsed[i] = true;
+      found ++;
+    }
+
+    if(fieldend == end) break;
+    field = fieldend + 1;
+  }
+
+  return count - found;
+}
+
+// a text file being converted, split into chunks
+struct CsvChunk
+{
+  const char *begin, *end;
+
+  // the index of the first sample of the chunk and the number of samples
+  int first, rows;
+  int errors;
+};
+
+struct CsvTask
+{
+  CsvConverter *converter;
+  CsvChunk *chunks;
+
+  // the range of the values of each chunk, one after the other
+  double *minimums, *maximums;
+};
+
+void CsvConverter::ScanTask(void *param, int index, int)
+{
+  CsvTask *task = (CsvTask *)param;
+  CsvConverter *converter = task->converter;
+  CsvChunk *chunk = &task->chunks[index];
+
+  int samplesize = converter->inputcount + converter->targetcount;
+  double *minimums = task->minimums + index * samplesize, *maximums = task->maximums + index * samplesize;
+  for(int i = 0; i < samplesize; i ++) {
+    minimums[i] = DBL_MAX;
+    maximums[i] = -DBL_MAX;
+  }
+
+  double *sample = new double[samplesize];
+  bool *parsed = new bool[samplesize];
+  chunk->rows = 0;
+  chunk->errors = 0;
+
+  const char *next;
+  for(const char *line = chunk->begin; line < chunk->end; line = next) {
+    const char *lineend = FindLineEnd(line, chunk->end, next);
+    if(IsBlank(line, lineend)) continue;
+
+    // a field that isn't a number would pull the range towards 0
+    if(converter->scale) {
+      chunk->errors += converter->ParseLine(line, lineend, sample, parsed);
+      for(int i = 0; i < samplesize; i ++) {
+        if(!parsed[i]) continue;
+        minimums[i] = min(minimums[i], sample[i]);
+        maximums[i] = max(maximums[i], sample[i]);
+      }
+    }
+
+    chunk->rows ++;
+  }
+
+  delete[] sample;
+  delete[] parsed;
+}
+
+void CsvConverter::ConvertTask(void *param, int index, int)
+{
+  CsvTask *task = (CsvTask *)param;
+  CsvConverter *converter = task->converter;
+  CsvChunk *chunk = &task->chunks[index];
+
+  int samplesize = converter->inputcount + converter->targetcount;
+  double *sample = new double[samplesize];
+  bool *parsed = new bool[samplesize];
+  int row = chunk->first;
+  int errors = 0;
+
+  const char *next;
+  for(const char *line = chunk->begin; line < chunk->end; line = next) {
+    const char *lineend = FindLineEnd(line, chunk->end, next);
+    if(IsBlank(line, lineend)) continue;
+
+    errors += converter->ParseLine(line, lineend, sample, parsed);
+
+    if(converter->scale) {
+      for(int i = 0; i < samplesize; i ++) {
+        double range = converter->maximums[i] - converter->minimums[i];
+        sample[i] = range > 0.0 && parsed[i] ? (sample[i] - converter->minimums[i]) / range : 0.0;
+      }
+    }
+
+    converter->dataset->SetSample(row ++, sample, sample + converter->inputcount);
+  }
+
+  // the lines were parsed while scanning if they're scaled
+  if(!converter->scale)
+    chunk->errors = errors;
+
+  delete[] sample;
+  delete[] parsed;
+}
+
+bool CsvConverter::Convert(const char *textfile, const char *datasetfile, int type)
+{
+  rowcount = errorcount = 0;
+  safe_delete_array(minimums);
+  safe_delete_array(maximums);
+
+  MappedFile text;
+  if(!text.Open(textfile)) return false;
+  text.Advise(true);
+
+  const char *begin = (const char *)text.GetData(), *end = begin + text.GetSize(), *next;
+
+  // skip the header and find the first sample, which sets the default columns
+  if(header)
+    FindLineEnd(begin, end, begin);
+
+  const char *first = begin, *firstend = null;
+  for(; first < end; first = next) {
+    firstend = FindLineEnd(first, end, next);
+    if(!IsBlank(first, firstend)) break;
+  }
+  if(first == end || !MapColumns(first, firstend)) return false;
+
+  // a few chunks for each thread even out the differences between them,
+  // the chunks are moved to start at the beginning of a line
+  int threads = pool != null ? pool->GetThreadCount() : 1;
+  int chunkcount = (int)max(1LL, min((long long)threads * 4, (long long)(end - begin) / 65536));
+  CsvChunk *chunks = new CsvChunk[chunkcount];
+
+  for(int i = 0; i < chunkcount; i ++) {
+    const char *start = begin + (end - begin) * i / chunkcount;
+    if(i > 0 && start[-1] != '\n') {
+      const char *newline = (const char *)memchr(start, '\n', end - start);
+      start = newline != null ? newline + 1 : end;
+    }
+    chunks[i].begin = start;
+    if(i > 0) chunks[i - 1].end = max(chunks[i - 1].begin, start);
+  }
+  chunks[chunkcount - 1].end = end;
+
+  int samplesize = inputcount + targetcount;
+  CsvTask task;
+  task.converter = this;
+  task.chunks = chunks;
+  task.minimums = new double[chunkcount * samplesize];
+  task.maximums = new double[chunkcount * samplesize];
+
+  if(pool != null)
+    pool->Run(ScanTask, &task, chunkcount);
+  else {
+    for(int i = 0; i < chunkcount; i ++)
+      ScanTask(&task, i, chunkcount);
+  }
+
+  // the chunks know where their samples go once all the lines are counted
+  long long rows = 0;
+  for(int i = 0; i < chunkcount; i ++) {
+    chunks[i].first = (int)rows;
+    rows += chunks[i].rows;
+  }
+
+  bool converted = false;
+  if(rows > 0 && rows <= 0x7fffffff) {
+    rowcount = (int)rows;
+
+    minimums = new double[samplesize];
+    maximums = new double[samplesize];
+    for(int i = 0; i < samplesize; i ++) {
+      minimums[i] = DBL_MAX;
+      maximums[i] = -DBL_MAX;
+      for(int j = 0; j < chunkcount; j ++) {
+        minimums[i] = min(minimums[i], task.minimums[j * samplesize + i]);
+        maximums[i] = max(maximums[i], task.maximums[j * samplesize + i]);
+      }
+
+      // a column without a single number
+      if(minimums[i] > maximums[i])
+        minimums[i] = maximums[i] = 0.0;
+    }
+
+    FileDataset file;
+    if(file.Create(datasetfile, rowcount, inputcount, targetcount, type)) {
+      dataset = &file;
+      if(pool != null)
+        pool->Run(ConvertTask, &task, chunkcount);
+      else {
+        for(int i = 0; i < chunkcount; i ++)
+          ConvertTask(&task, i, chunkcount);
+      }
+      dataset = null;
+
+      for(int i = 0; i < chunkcount; i ++)
+        errorcount += chunks[i].errors;
+
+      file.Close();
+      converted = true;
+    }
+  }
+
+  if(!scale || !converted) {
+    safe_delete_array(minimums);
+    safe_delete_array(maximums);
+  }
+
+  delete[] task.minimums;
+  delete[] task.maximums;
+  delete[] chunks;
+  return converted;
+}
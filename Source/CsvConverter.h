@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Dataset.h"
+
+// converts a text file of comma separated values into a dataset file, see FileDataset
+// each line that isn't blank is a sample, some of its columns are the inputs
+// and some are the targets, the other columns are skipped without being parsed
+// the fields have to be plain numbers, quoted fields aren't supported
+// the text is mapped into memory, split into chunks at line breaks and the chunks
+// are parsed on the threads of a pool, each writing its samples straight into
+// the dataset file, which is mapped into memory as well
+class CsvConverter
+{
+protected:
+  char separator;
+  bool header;
+  bool scale;
+
+  // the columns of the inputs and of the targets, see SetColumns
+  int *columns;
+  int inputcount, targetcount;
+
+  // the place of each column in a sample, or -1 for the skipped columns
+  int *columnmap;
+  int columncount;
+
+  ThreadPool *pool;
+
+  // the smallest and the largest value of each input and target
+  double *minimums, *maximums;
+
+  int rowcount, errorcount;
+
+  // the dataset being written by the tasks
+  FileDataset *dataset;
+
+  // finds the place of each column, returns false if there are no columns
+  bool MapColumns(const char *text, const char *end);
+
+  // parses the selected fields of a line into a sample, the missing and the bad fields
+  // are 0, returns the number of them
+  // parsed, if it's not null, tells which fields were numbers, so that the others
+  // can be left out of the range of the values
+  int ParseLine(const char *text, const char *end, double *sample, bool *parsed = null);
+
+  // the tasks run by the pool, they get the CsvTask describing the chunks
+  // the first counts the lines of a chunk and finds the range of the values if they're scaled,
+  // the second parses and writes them
+  static void ScanTask(void *param, int index, int count);
+  static void ConvertTask(void *param, int index, int count);
+
+public:
+  // the character between the fields, a comma by default
+  inline char& Separator() { return separator; }
+
+  // whether the first line holds the names of the columns and is skipped, false by default
+  inline bool& Header() { return header; }
+
+  // whether each input and target is scaled from its smallest to its largest value
+  // to the range from 0 to 1, which is what the sigmoid transfer function puts out
+  // true by default
+  inline bool& Scale() { return scale; }
+
+  // selects the columns of the inputs and of the targets, counting from 0
+  // by default the last column is the target and all the others are inputs
+  void SetColumns(const int *inputcolumns, int inputcount, const int *targetcolumns, int targetcount);
+
+  // spreads the parsing over the threads of the pool, a null pool parses on the calling thread
+  inline void SetThreadPool(ThreadPool *pool) { this->pool = pool; }
+
+  // converts a text file into a dataset file of doubles or floats, see FileDataset::Type
+  // returns false if the text file can't be read, has no samples, or the dataset file can't be written
+  bool Convert(const char *textfile, const char *datasetfile, int type = FileDataset::Double);
+
+  // the number of samples and of missing or bad fields of the last conversion
+  inline int GetRowCount() { return rowcount; }
+  inline int GetErrorCount() { return errorcount; }
+
+  // the range of each input and then each target found by the last conversion with scaling,
+  // new samples have to be scaled the same way before they're fed to a net trained on them
+  // the missing and bad fields don't count towards the range and are 0 after scaling
+  inline const double* GetMinimums() { return minimums; }
+  inline const double* GetMaximums() { return maximums; }
+
+  // parses a number from text to end, surrounded by spaces or not, a lot faster than strtod
+  // for the usual numbers, which have up to 15 digits, others are left to strtod
+  // returns false if it's not a number
+  static bool ParseNumber(const char *text, const char *end, double &value);
+
+  CsvConverter();
+  ~CsvConverter();
+};
@@ -0,0 +1,384 @@
+#include <stdlib.h>
+#include <memory.h>
+#include "Dataset.h"
+
+Dataset::Dataset(int in, int out) : inputcount(in), targetcount(out)
+{
+}
+
+Dataset::~Dataset()
+{
+}
+
+void Dataset::GetBatch(const int *indices, int n, double *inputs, double *targets)
+{
+  for(int r = 0; r < n; r ++) {
+    if(inputs != null)
+      memcpy(inputs + (long long)r * inputcount, GetInput(indices[r]), inputcount * sizeof(double));
+    if(targets != null)
+      memcpy(targets + (long long)r * targetcount, GetTarget(indices[r]), targetcount * sizeof(double));
+  }
+}
+
+bool Dataset::GetView(int, int, const double *&, const double *&)
+{
+  return false;
+}
+
+MemoryDataset::MemoryDataset(const double *in, const double *out, int count,
+                             int incount, int outcount, bool copy) :
+  Dataset(incount, outcount), size(count), owned(copy)
+{
+  if(copy) {
+    inputs = new double[(long long)size * inputcount];
+    targets = new double[(long long)size * targetcount];
+    memcpy(inputs, in, (long long)size * inputcount * sizeof(double));
+    memcpy(targets, out, (long long)size * targetcount * sizeof(double));
+  } else {
+    inputs = (double *)in;
+    targets = (double *)out;
+  }
+}
+
+MemoryDataset::~MemoryDataset()
+{
+  if(owned) {
+    safe_delete_array(inputs);
+    safe_delete_array(targets);
+  }
+}
+
+void MemoryDataset::GetBatch(const int *indices, int n, double *in, double *out)
+{
+  // the rows are where they are, there's no need for the virtual calls
+  for(int r = 0; r < n; r ++) {
+    if(in != null)
+      memcpy(in + (long long)r * inputcount, inputs + (long long)indices[r] * inputcount, inputcount * sizeof(double));
+    if(out != null)
+      memcpy(out + (long long)r * targetcount, targets + (long long)indices[r] * targetcount, targetcount * sizeof(double));
+  }
+}
+
+bool MemoryDataset::GetView(int first, int, const double *&in, const double *&out)
+{
+  in = inputs + (long long)first * inputcount;
+  out = targets + (long long)first * targetcount;
+  return true;
+}
+
+//*** FileDataset
+
+FileDataset::FileDataset() : Dataset(0, 0), size(0), type(Double), inputs(null), targets(null), sample(null)
+{
+}
+
+FileDataset::~FileDataset()
+{
+  Close();
+}
+
+void FileDataset::Close()
+{
+  file.Close();
+  safe_delete_array(sample);
+  inputs = targets = null;
+  size = inputcount = targetcount = 0;
+}
+
+void FileDataset::Attach(Header *header)
+{
+  size = (int)header->size;
+  type = header->type;
+  inputcount = header->inputcount;
+  targetcount = header->targetcount;
+
+  int width = type == Float ? sizeof(float) : sizeof(double);
+  inputs = (char *)file.GetData() + HeaderSize;
+  targets = inputs + (long long)size * inputcount * width;
+  sample = new double[inputcount + targetcount];
+}
+
+bool FileDataset::Open(const char *filename)
+{
+  Close();
+
+  if(!file.Open(filename) || file.GetSize() < HeaderSize) {
+    file.Close();
+    return false;
+  }
+
+  Header *header = (Header *)file.GetData();
+  int width = header->type == Float ? sizeof(float) : sizeof(double);
+  if(header->tag != FileTag || header->version != FileVersion ||
+     (header->type != Double && header->type != Float) ||
+     header->inputcount <= 0 || header->targetcount < 0 || header->size < 0 || header->size > 0x7fffffff ||
+     file.GetSize() < HeaderSize + header->size * (header->inputcount + header->targetcount) * width) {
+    file.Close();
+    return false;
+  }
+
+  Attach(header);
+  return true;
+}
+
+bool FileDataset::Create(const char *filename, int count, int incount, int outcount, int t)
+{
+  Close();
+
+  int width = t == Float ? sizeof(float) : sizeof(double);
+  if(!file.Create(filename, HeaderSize + (long long)count * (incount + outcount) * width))
+    return false;
+
+  Header *header = (Header *)file.GetData();
+  header->tag = FileTag;
+  header->version = FileVersion;
+  header->type = t;
+  header->inputcount = incount;
+  header->targetcount = outcount;
+  header->reserved = 0;
+  header->size = count;
+
+  Attach(header);
+  return true;
+}
+
+// converts count numbers between the types
+template<class from, class to> static void Convert(const from *in, to *out, int count)
+{
+  for(int i = 0; i < count; i ++)
+    out[i] = (to)in[i];
+}
+
+void FileDataset::SetSample(int index, const double *in, const double *out)
+{
+  if(type == Float) {
+    if(in != null) Convert(in, (float *)inputs + (long long)index * inputcount, inputcount);
+    if(out != null) Convert(out, (float *)targets + (long long)index * targetcount, targetcount);
+  } else {
+    if(in != null) memcpy((double *)inputs + (long long)index * inputcount, in, inputcount * sizeof(double));
+    if(out != null) memcpy((double *)targets + (long long)index * targetcount, out, targetcount * sizeof(double));
+  }
+}
+
+const double* FileDataset::GetInput(int index)
+{
+  if(type == Double) return (double *)inputs + (long long)index * inputcount;
+
+  Convert((float *)inputs + (long long)index * inputcount, sample, inputcount);
+  return sample;
+}
+
+const double* FileDataset::GetTarget(int index)
+{
+  if(type == Double) return (double *)targets + (long long)index * targetcount;
+
+  Convert((float *)targets + (long long)index * targetcount, sample + inputcount, targetcount);
+  return sample + inputcount;
+}
+
+void FileDataset::GetBatch(const int *indices, int n, double *in, double *out)
+{
+  for(int r = 0; r < n; r ++) {
+    long long index = indices[r];
+    if(type == Float) {
+      if(in != null) Convert((float *)inputs + index * inputcount, in + r * inputcount, inputcount);
+      if(out != null) Convert((float *)targets + index * targetcount, out + r * targetcount, targetcount);
+    } else {
+      if(in != null) memcpy(in + r * inputcount, (double *)inputs + index * inputcount, inputcount * sizeof(double));
+      if(out != null) memcpy(out + r * targetcount, (double *)targets + index * targetcount, targetcount * sizeof(double));
+    }
+  }
+}
+
+bool FileDataset::GetView(int first, int, const double *&in, const double *&out)
+{
+  if(type != Double) return false;
+
+  in = (double *)inputs + (long long)first * inputcount;
+  out = (double *)targets + (long long)first * targetcount;
+  return true;
+}
+
+bool FileDataset::Save(const char *filename, Dataset *dataset, int t)
+{
+  FileDataset file;
+  if(!file.Create(filename, dataset->GetSize(), dataset->GetInputCount(), dataset->GetTargetCount(), t))
+    return false;
+
+  for(int i = 0; i < dataset->GetSize(); i ++)
+    file.SetSample(i, dataset->GetInput(i), dataset->GetTarget(i));
+
+  file.Close();
+  return true;
+}
+
+//*** SampleOrder
+
+SampleOrder::SampleOrder(int count) : indices(null), size(0)
+{
+  Reset(count);
+}
+
+SampleOrder::~SampleOrder()
+{
+  safe_delete_array(indices);
+}
+
+void SampleOrder::Reset(int count)
+{
+  if(count != size || indices == null) {
+    safe_delete_array(indices);
+    size = count;
+    indices = size > 0 ? new int[size] : null;
+  }
+
+  for(int i = 0; i < size; i ++)
+    indices[i] = i;
+}
+
+void SampleOrder::Shuffle()
+{
+  // Fisher-Yates, RAND_MAX may be as small as 32767 so two numbers
+  // are combined for larger datasets, in 64 bits so that nothing overflows
+  const unsigned long long range = (unsigned long long)RAND_MAX + 1;
+  for(int i = size - 1; i > 0; i --) {
+    unsigned long long r = (unsigned long long)Random::GetInt();
+    if((unsigned long long)i >= range - 1) r = r * range + (unsigned long long)Random::GetInt();
+    int j = (int)(r % (unsigned long long)(i + 1));
+
+    int temp = indices[i];
+    indices[i] = indices[j];
+    indices[j] = temp;
+  }
+}
+
+//*** Prefetcher
+
+Prefetcher::Prefetcher() : dataset(null), batchsize(0), shuffle(true), prepare(null), param(null),
+  batches(null), ringsize(0), head(0), count(0), current(null), quit(false), epoch(0), position(0),
+  stalltime(0.0), batchcount(0)
+{
+}
+
+Prefetcher::~Prefetcher()
+{
+  Stop();
+}
+
+bool Prefetcher::Start(Dataset *d, int size, int ring, bool s)
+{
+  Stop();
+  if(d == null || d->GetSize() == 0) return false;
+
+  dataset = d;
+  batchsize = max(1, min(size, d->GetSize()));
+  shuffle = s;
+
+  ringsize = max(1, ring);
+  batches = new Batch[ringsize];
+  for(int i = 0; i < ringsize; i ++) {
+    batches[i].inputs = (double *)batches[i].inputbuffer.GetBuffer((size_t)batchsize * d->GetInputCount() * sizeof(double));
+    batches[i].targets = (double *)batches[i].targetbuffer.GetBuffer((size_t)batchsize * d->GetTargetCount() * sizeof(double));
+  }
+
+  head = count = 0;
+  current = null;
+  quit = false;
+  order.Reset(d->GetSize());
+  epoch = position = 0;
+  ResetStatistics();
+
+  if(!thread.Start(Produce, this)) {
+    Stop();
+    return false;
+  }
+  return true;
+}
+
+void Prefetcher::Stop()
+{
+  mutex.Lock();
+  quit = true;
+  space.Broadcast();
+  mutex.Unlock();
+
+  thread.Join();
+
+  safe_delete_array(batches);
+  ringsize = head = count = 0;
+  current = null;
+  dataset = null;
+}
+
+void Prefetcher::Fill(Batch *batch)
+{
+  int size = dataset->GetSize();
+  if(position == 0 && shuffle)
+    order.Shuffle();
+
+  batch->n = min(batchsize, size - position);
+  batch->epoch = epoch;
+  batch->last = position + batch->n == size;
+  dataset->GetBatch(order.GetIndices(position), batch->n, batch->inputs, batch->targets);
+
+  if(prepare != null)
+    prepare(batch->inputs, batch->targets, batch->n, param);
+
+  position += batch->n;
+  if(position == size) {
+    position = 0;
+    epoch ++;
+  }
+}
+
+void Prefetcher::Produce(void *p)
+{
+  Prefetcher *prefetcher = (Prefetcher *)p;
+  Mutex *mutex = &prefetcher->mutex;
+
+  mutex->Lock();
+  while(true) {
+    while(prefetcher->count == prefetcher->ringsize && !prefetcher->quit)
+      prefetcher->space.Wait(mutex);
+    if(prefetcher->quit) break;
+
+    // the slot after the ready batches belongs to this thread until it's counted in
+    Batch *batch = &prefetcher->batches[(prefetcher->head + prefetcher->count) % prefetcher->ringsize];
+    mutex->Unlock();
+
+    prefetcher->Fill(batch);
+
+    mutex->Lock();
+    prefetcher->count ++;
+    prefetcher->ready.Signal();
+  }
+  mutex->Unlock();
+}
+
+Prefetcher::Batch* Prefetcher::Next()
+{
+  if(!thread.IsStarted()) return null;
+
+  mutex.Lock();
+
+  // give the previous batch back
+  if(current != null) {
+    head = (head + 1) % ringsize;
+    count --;
+    current = null;
+    space.Signal();
+  }
+
+  if(count == 0) {
+    double start = Clock::GetSeconds();
+    while(count == 0)
+      ready.Wait(&mutex);
+    stalltime += Clock::GetSeconds() - start;
+  }
+
+  current = &batches[head];
+  batchcount ++;
+  mutex.Unlock();
+
+  return current;
+}
@@ -0,0 +1,257 @@
+#pragma once
+
+#include "Util.h"
+
+// a dataset is a fixed set of samples, each made of an array of inputs and
+// an array of desired outputs, the targets, found by the index of the sample
+// the trainers take their samples from a dataset, see NetTrainer::SetDataset
+class Dataset
+{
+protected:
+  int inputcount, targetcount;
+
+public:
+  // the number of samples
+  virtual int GetSize() = 0;
+
+  inline int GetInputCount() { return inputcount; }
+  inline int GetTargetCount() { return targetcount; }
+
+  // return the inputs and the targets of a sample, the arrays belong to the dataset
+  virtual const double* GetInput(int index) = 0;
+  virtual const double* GetTarget(int index) = 0;
+
+  // copies the n samples with the given indices one after the other
+  // into inputs and targets, either of which may be null
+  virtual void GetBatch(const int *indices, int n, double *inputs, double *targets);
+
+  // points inputs and targets at the samples first to first + n - 1, without copying them,
+  // if the dataset stores them one after the other as doubles, otherwise returns false
+  virtual bool GetView(int first, int n, const double *&inputs, const double *&targets);
+
+  Dataset(int inputcount, int targetcount);
+  virtual ~Dataset();
+};
+
+// a dataset kept in memory as two arrays with one row per sample
+class MemoryDataset : public Dataset
+{
+protected:
+  double *inputs, *targets;
+  int size;
+
+  // whether the arrays are copies that belong to the dataset
+  bool owned;
+
+public:
+  inline int GetSize() { return size; }
+
+  inline const double* GetInput(int index) { return inputs + (long long)index * inputcount; }
+  inline const double* GetTarget(int index) { return targets + (long long)index * targetcount; }
+
+  void GetBatch(const int *indices, int n, double *inputs, double *targets);
+  bool GetView(int first, int n, const double *&inputs, const double *&targets);
+
+  // size rows of inputcount inputs and of targetcount targets
+  // the arrays are copied, unless copy is false, in which case they are used
+  // as they are and must stay valid as long as the dataset
+  MemoryDataset(const double *inputs, const double *targets, int size,
+                int inputcount, int targetcount, bool copy = true);
+  ~MemoryDataset();
+};
+
+// a dataset stored in a file, which is mapped into memory instead of being read,
+// so it may be larger than the memory, see MappedFile
+// the file starts with a header, followed by the inputs of all the samples,
+// one row after the other, and then by the targets of all the samples
+// the numbers are doubles or floats, which take half the space
+// batches of consecutive samples are used where they are in the mapping,
+// see GetView, shuffled batches are gathered from it, see GetBatch and SampleOrder
+class FileDataset : public Dataset
+{
+public:
+  enum Type { Double, Float };
+
+protected:
+  enum { FileTag = 0x54455344, FileVersion = 1 };
+
+  // the header takes up 64 bytes, so that the rows are aligned
+  struct Header
+  {
+    int tag, version, type;
+    int inputcount, targetcount;
+    int reserved;
+    long long size;
+  };
+  enum { HeaderSize = 64 };
+
+  MappedFile file;
+  int size, type;
+
+  // the inputs and the targets in the mapping
+  char *inputs, *targets;
+
+  // the sample returned by GetInput and GetTarget for files of floats
+  double *sample;
+
+  // sets up the dataset for the mapped file, whose header is already checked
+  void Attach(Header *header);
+
+public:
+  inline int GetSize() { return size; }
+  inline int GetType() { return type; }
+  inline bool IsOpen() { return file.IsOpen(); }
+
+  // for files of floats the sample is converted to doubles in a buffer shared by
+  // GetInput and GetTarget, so the arrays are only valid until the next call
+  // and the dataset can't be used by several threads at once
+  const double* GetInput(int index);
+  const double* GetTarget(int index);
+
+  void GetBatch(const int *indices, int n, double *inputs, double *targets);
+  bool GetView(int first, int n, const double *&inputs, const double *&targets);
+
+  // opens a dataset file, returns false if it's missing or not a dataset file
+  bool Open(const char *filename);
+
+  // creates a dataset file for size samples, whose numbers are all 0
+  // until they're set by SetSample
+  bool Create(const char *filename, int size, int inputcount, int targetcount, int type = Double);
+
+  // sets the inputs and the targets of a sample of a created file, either may be null
+  // several threads may set different samples at once
+  void SetSample(int index, const double *inputs, const double *targets);
+
+  // tells the system whether the samples are going to be read in order or shuffled
+  inline void Advise(bool sequential) { file.Advise(sequential); }
+
+  // closes the file, the samples set in a created file are saved
+  void Close();
+
+  // writes all the samples of a dataset to a file
+  static bool Save(const char *filename, Dataset *dataset, int type = Double);
+
+  FileDataset();
+  ~FileDataset();
+};
+
+// the order in which the samples of a dataset are visited during an epoch
+// it's a permutation of the indices of the samples, so shuffling it
+// doesn't move the samples themselves
+class SampleOrder
+{
+  int *indices;
+  int size;
+
+public:
+  inline int GetSize() { return size; }
+
+  // returns the index of the i-th sample of the epoch
+  inline int Get(int i) { return indices[i]; }
+
+  // returns the indices from the i-th sample of the epoch on
+  inline const int* GetIndices(int i = 0) { return indices + i; }
+
+  // puts the indices of size samples in their natural order
+  void Reset(int size);
+
+  // shuffles the indices for a new epoch
+  void Shuffle();
+
+  SampleOrder(int size = 0);
+  ~SampleOrder();
+};
+
+// prepares a batch of n samples on the thread of a Prefetcher, for instance by
+// scaling the inputs or computing features from them, in place
+typedef void (*PREPAREFUNCTION)(double *inputs, double *targets, int n, void *param);
+
+// a prefetcher gets batches of samples ready on a thread of its own, while the
+// trainer is busy with the previous ones, see BPTrainer::TrainEpoch
+// the batches are gathered from the dataset in a new random order each epoch,
+// converted to doubles, prepared and put in a ring of a few batches, where they
+// wait until the trainer takes them, so the time spent reading and preparing
+// the samples overlaps with training
+// the dataset and the param of the prepare function are only used by the
+// prefetcher's thread between Start and Stop
+class Prefetcher
+{
+public:
+  struct Batch
+  {
+    double *inputs, *targets;
+    int n;
+
+    // the epoch the batch belongs to, counting from 0, and whether it's the last one of the epoch
+    int epoch;
+    bool last;
+
+    MemoryBuffer inputbuffer, targetbuffer;
+  };
+
+protected:
+  Dataset *dataset;
+  int batchsize;
+  bool shuffle;
+
+  PREPAREFUNCTION prepare;
+  void *param;
+
+  // the ring of batches, count batches from head on are ready
+  Batch *batches;
+  int ringsize, head, count;
+
+  // the batch returned by the last call to Next, it's kept until the next call
+  Batch *current;
+
+  Thread thread;
+  Mutex mutex;
+  Condition ready, space;
+  bool quit;
+
+  // where the thread is in the dataset
+  SampleOrder order;
+  int epoch, position;
+
+  // the time the trainer spent waiting in Next and the number of batches it took
+  double stalltime;
+  int batchcount;
+
+  // the loop run by the thread
+  static void Produce(void *prefetcher);
+
+  // gathers and prepares the next batch of the dataset
+  void Fill(Batch *batch);
+
+public:
+  // sets a function run on each batch before it goes into the ring
+  // it can't be changed while the prefetcher is running
+  inline void SetPrepareFunction(PREPAREFUNCTION prepare, void *param = null) { this->prepare = prepare; this->param = param; }
+
+  // starts getting batches of batchsize samples of the dataset ready, ringsize at most
+  // the samples are shuffled at the start of each epoch, unless shuffle is false
+  // returns false if the thread couldn't be started
+  bool Start(Dataset *dataset, int batchsize, int ringsize = 4, bool shuffle = true);
+
+  // stops the thread and drops the batches that are still in the ring
+  void Stop();
+
+  inline bool IsStarted() { return thread.IsStarted(); }
+  inline Dataset* GetDataset() { return dataset; }
+  inline int GetBatchSize() { return batchsize; }
+
+  // returns the next batch, waiting for it if it's not ready yet
+  // the batch stays valid until the next call, when its place in the ring is given back
+  Batch* Next();
+
+  // the total time in seconds spent waiting in Next, which is how long the trainer
+  // stalled on the data, and the number of batches returned since the start
+  // if the stall time is a significant part of the training time, the data
+  // can't be prepared fast enough
+  inline double GetStallTime() { return stalltime; }
+  inline int GetBatchCount() { return batchcount; }
+  inline void ResetStatistics() { stalltime = 0.0; batchcount = 0; }
+
+  Prefetcher();
+  ~Prefetcher();
+};
@@ -0,0 +1,228 @@
+#include <math.h>
+#include <memory.h>
+#include "Evaluator.h"
+
+Evaluator::Evaluator() : pool(null), backgroundpool(null), batchsize(256), workers(null), workercount(0), dataset(null),
+  evaluated(false)
+{
+  memset(&result, 0, sizeof(result));
+}
+
+Evaluator::~Evaluator()
+{
+  thread.Join();
+  safe_delete_array(workers);
+}
+
+// the sums the evaluation is made of
+struct EvaluationSums
+{
+  double error, squarederror;
+  int correct, count;
+};
+
+// adds the errors of n samples to the sums
+static void Measure(const double *outputs, const double *targets, int n, int outputcount, EvaluationSums *sums)
+{
+  for(int r = 0; r < n; r ++) {
+    const double *output = outputs + r * outputcount, *target = targets + r * outputcount;
+
+    int largest = 0, largesttarget = 0;
+    for(int i = 0; i < outputcount; i ++) {
+      double difference = target[i] - output[i];
+      sums->error += fabs(difference);
+      sums->squarederror += difference * difference;
+
+      if(output[i] > output[largest]) largest = i;
+      if(target[i] > target[largesttarget]) largesttarget = i;
+    }
+
+    if(outputcount == 1)
+      sums->correct += (output[0] >= 0.5) == (target[0] >= 0.5);
+    else
+      sums->correct += largest == largesttarget;
+  }
+  sums->count += n;
+}
+
+static void GetEvaluation(EvaluationSums *sums, int outputcount, Evaluation &result)
+{
+  int count = max(1, sums->count);
+  result.meanerror = sums->error / ((double)count * outputcount);
+  result.squarederror = sums->squarederror / ((double)count * outputcount);
+  result.accuracy = (double)sums->correct / (double)count;
+  result.count = sums->count;
+}
+
+// a dataset being evaluated on several threads
+struct EvaluationTask
+{
+  Evaluator *evaluator;
+  Dataset *dataset;
+
+  // the nets used by the tasks and the sums of each task
+  CompiledNet *nets;
+  EvaluationSums *sums;
+};
+
+void Evaluator::EvaluateTask(void *param, int index, int count)
+{
+  EvaluationTask *task = (EvaluationTask *)param;
+  Dataset *dataset = task->dataset;
+  CompiledNet *net = &task->nets[index];
+  EvaluationSums *sums = &task->sums[index];
+
+  int size = dataset->GetSize(), batchsize = max(1, task->evaluator->batchsize);
+  int r0 = (int)((long long)size * index / count);
+  int r1 = (int)((long long)size * (index + 1) / count);
+  int inputcount = dataset->GetInputCount(), outputcount = dataset->GetTargetCount();
+
+  // consecutive samples are used where they are if the dataset allows it
+  double *inputbuffer = new double[batchsize * inputcount];
+  double *targetbuffer = new double[batchsize * outputcount];
+  double *outputs = new double[batchsize * outputcount];
+  int *indices = new int[batchsize];
+
+  for(int first = r0; first < r1; first += batchsize) {
+    int n = min(batchsize, r1 - first);
+
+    const double *inputs, *targets;
+    if(!dataset->GetView(first, n, inputs, targets)) {
+      for(int r = 0; r < n; r ++)
+        indices[r] = first + r;
+      dataset->GetBatch(indices, n, inputbuffer, targetbuffer);
+      inputs = inputbuffer;
+      targets = targetbuffer;
+    }
+
+    net->UpdateBatch(inputs, n, outputs);
+    Measure(outputs, targets, n, outputcount, sums);
+  }
+
+  delete[] inputbuffer;
+  delete[] targetbuffer;
+  delete[] outputs;
+  delete[] indices;
+}
+
+void Evaluator::EvaluateCompiled(Dataset *d, ThreadPool *pool, Evaluation &r)
+{
+  // one copy of the net for each thread, sharing the weights
+  int count = 1;
+  CompiledNet *nets = &compiled;
+  if(pool != null && pool->GetThreadCount() > 1 && d->GetSize() > batchsize) {
+    count = min(pool->GetThreadCount(), (d->GetSize() + batchsize - 1) / max(1, batchsize));
+    if(workercount != count) {
+      safe_delete_array(workers);
+      workers = new CompiledNet[count];
+      workercount = count;
+    }
+    for(int i = 0; i < count; i ++)
+      workers[i].Share(&compiled);
+    nets = workers;
+  }
+
+  EvaluationSums *sums = new EvaluationSums[count];
+  memset(sums, 0, count * sizeof(EvaluationSums));
+
+  EvaluationTask task;
+  task.evaluator = this;
+  task.dataset = d;
+  task.nets = nets;
+  task.sums = sums;
+
+  if(count > 1)
+    pool->Run(EvaluateTask, &task, count);
+  else
+    EvaluateTask(&task, 0, 1);
+
+  EvaluationSums total;
+  memset(&total, 0, sizeof(total));
+  for(int i = 0; i < count; i ++) {
+    total.error += sums[i].error;
+    total.squarederror += sums[i].squarederror;
+    total.correct += sums[i].correct;
+    total.count += sums[i].count;
+  }
+  GetEvaluation(&total, d->GetTargetCount(), r);
+
+  delete[] sums;
+}
+
+bool Evaluator::Evaluate(NeuralNet *net, Dataset *d, Evaluation &r)
+{
+  int inputcount = net->GetInputs()->GetSize(), outputcount = net->GetOutputs()->GetSize();
+  if(d->GetSize() == 0 || d->GetInputCount() != inputcount || d->GetTargetCount() != outputcount)
+    return false;
+
+  if(compiled.Compile(net)) {
+    EvaluateCompiled(d, pool, r);
+    return true;
+  }
+
+  // one sample at a time
+  EvaluationSums sums;
+  memset(&sums, 0, sizeof(sums));
+  double *inputs = new double[inputcount], *targets = new double[outputcount], *outputs = new double[outputcount];
+
+  for(int i = 0; i < d->GetSize(); i ++) {
+    d->GetBatch(&i, 1, inputs, targets);
+    net->Update(inputs, outputs);
+    Measure(outputs, targets, 1, outputcount, &sums);
+  }
+  GetEvaluation(&sums, outputcount, r);
+
+  delete[] inputs;
+  delete[] targets;
+  delete[] outputs;
+  return true;
+}
+
+void Evaluator::Run(void *param)
+{
+  Evaluator *evaluator = (Evaluator *)param;
+
+  Evaluation r;
+  evaluator->EvaluateCompiled(evaluator->dataset, evaluator->backgroundpool, r);
+
+  evaluator->mutex.Lock();
+  evaluator->result = r;
+  evaluator->evaluated = true;
+  evaluator->mutex.Unlock();
+}
+
+bool Evaluator::Start(NeuralNet *net, Dataset *d)
+{
+  thread.Join();
+
+  int inputcount = net->GetInputs()->GetSize(), outputcount = net->GetOutputs()->GetSize();
+  if(d->GetSize() == 0 || d->GetInputCount() != inputcount || d->GetTargetCount() != outputcount)
+    return false;
+
+  // the compiled net is the snapshot of the weights
+  if(!compiled.Compile(net))
+    return false;
+
+  dataset = d;
+  evaluated = false;
+  return thread.Start(Run, this);
+}
+
+bool Evaluator::IsDone()
+{
+  if(!thread.IsStarted()) return true;
+
+  mutex.Lock();
+  bool done = evaluated;
+  mutex.Unlock();
+  return done;
+}
+
+bool Evaluator::Wait(Evaluation &r)
+{
+  if(!thread.IsStarted()) return false;
+
+  thread.Join();
+  r = result;
+  return true;
+}
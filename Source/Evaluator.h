@@ -0,0 +1,92 @@
+#pragma once
+
+#include "CompiledNet.h"
+#include "Dataset.h"
+
+// how well a net does on a dataset
+struct Evaluation
+{
+  // the mean absolute and the mean squared difference between the outputs and the targets
+  double meanerror, squarederror;
+
+  // the fraction of the samples that are classified right, see Evaluator
+  double accuracy;
+
+  // the number of samples
+  int count;
+};
+
+// an evaluator runs all the samples of a dataset through a net and measures the errors
+// the net is compiled and the samples go through it in batches, spread over
+// the threads of a pool, each thread has a copy of the compiled net sharing its weights
+// a sample with one output is classified right if the output and the target are
+// on the same side of 0.5, with several outputs if the largest output and
+// the largest target are at the same place
+// an evaluation can also run in the background, on a snapshot of the weights,
+// so a net can be validated while it's being trained, see Start
+class Evaluator
+{
+protected:
+  ThreadPool *pool, *backgroundpool;
+  int batchsize;
+
+  // the net being evaluated and a copy of it for each thread
+  CompiledNet compiled;
+  CompiledNet *workers;
+  int workercount;
+
+  // the evaluation running in the background
+  Thread thread;
+  Dataset *dataset;
+  Evaluation result;
+  bool evaluated;
+  Mutex mutex;
+
+  // evaluates the compiled net on the threads of the pool, or the calling thread if it's null
+  void EvaluateCompiled(Dataset *dataset, ThreadPool *pool, Evaluation &result);
+
+  // the task run by the pool, it gets the EvaluationTask describing the dataset
+  static void EvaluateTask(void *param, int index, int count);
+
+  // the function run by the background thread
+  static void Run(void *evaluator);
+
+public:
+  // spreads the batches of Evaluate over the threads of the pool, a null pool
+  // evaluates on the calling thread, which is the default
+  inline void SetThreadPool(ThreadPool *pool) { this->pool = pool; }
+  inline ThreadPool* GetThreadPool() { return pool; }
+
+  // spreads the batches of a background evaluation over the threads of the pool,
+  // see Start, it's used from the background thread, so it mustn't be the pool of
+  // the trainer or anything else running at the same time
+  // a null pool evaluates on the background thread alone, which is the default
+  inline void SetBackgroundThreadPool(ThreadPool *pool) { backgroundpool = pool; }
+  inline ThreadPool* GetBackgroundThreadPool() { return backgroundpool; }
+
+  // the number of samples that go through the net at once, 256 by default
+  inline int& BatchSize() { return batchsize; }
+
+  // evaluates the net on every sample of the dataset
+  // nets that can't be compiled are updated one sample at a time
+  // returns false if the dataset doesn't fit the net or is empty
+  bool Evaluate(NeuralNet *net, Dataset *dataset, Evaluation &result);
+
+  // starts evaluating the net in the background, its weights are copied first
+  // so the net can go on changing while it's evaluated, the dataset can't
+  // the evaluation runs on a thread of its own, and not on the pool of SetThreadPool,
+  // so it doesn't hold up a trainer using that pool, see SetBackgroundThreadPool
+  // the evaluator can't be used for anything else until Wait is called
+  // returns false if the net can't be compiled or the dataset doesn't fit it
+  bool Start(NeuralNet *net, Dataset *dataset);
+
+  // returns true if there's no background evaluation or it's finished
+  bool IsDone();
+
+  // waits for the background evaluation to finish and returns its result
+  // returns false if there was none
+  bool Wait(Evaluation &result);
+
+  Evaluator();
+  ~Evaluator();
+};
@@ -28,55 +28,24 @@ double outputs[] = {
   1,
   1 };
 
-void stockinput(double *input, int state)
-{
-  // select a random input, this will most likely come
-  // from some other source than memory
-  int r = Random::GetInt(0, 9); 
-  
-  // copy input from one buffer to another
-  for(int i = 0; i < 6; i ++)
-    input[i] = inputs[r][i];
-}
-
-void stocktrain(double *input, double *output)
-{
-  // match the input with the output
-  // in a real application there might be some other
-  // function which provides us with an expected output
-  int i = 0;
-  for(; i < 9; i ++) {
-    int j = 0;
-    for(; j < 6; j ++) {
-      if(inputs[i][j] != input[j]) break;
-    }
-
-    // if we've found a match
-    if(j == 6) break;
-  }
-
-  if(i == 9) {
-    // error couldn't find a matching input
-  } else
-    output[0] = outputs[i];
-}
-
-
 void train(LayeredNet *net)
 {
   BPTrainer trainer(6, 1); // 6 inputs, 1 output, the net must have the right size as well
   net->SetWeights(Neuron::RandomWeights);
-  trainer.SetInputFunction(stockinput);
-  trainer.SetTrainFunction(stocktrain);
 
-  int iterationcount = 100000;
+  // the samples will most likely come from some other source than memory,
+  // the arrays are used as they are, without copying
+  MemoryDataset dataset(&inputs[0][0], outputs, 9, 6, 1, false);
+  trainer.SetDataset(&dataset);
+
+  int epochcount = 10000;
   double precision = 0;
 
   printf("errors in output:\n");
   trainer.Step() = 10; // we set the step here
-  for(int i = 0; i < iterationcount; i ++) {
-    precision = trainer.Train(net, 0); // ignore state, set step to 10.0
-    if((i+1)%(iterationcount/20) == 0) printf("%g\n", precision);
+  for(int i = 0; i < epochcount; i ++) {
+    precision = trainer.TrainEpoch(net, 1); // every sample once, one at a time, in a random order
+    if((i+1)%(epochcount/20) == 0) printf("%g\n", precision);
   }
 }
 
@@ -211,8 +180,8 @@ void testBP()
 {
   LayeredNet net(2, 1);
 
-  net.AddLayer(new Layer(3));
-  // net.AddLayer(new Layer(2)); // can add another layer if we want to
+  net.AddLayer(3);
+  // net.AddLayer(2); // can add another layer if we want to
   net.ConnectGroups(); // connect all the layers together
 
   // create additional connections between the input and output layers
@@ -236,8 +205,7 @@ void testBP()
     if(net.Update(in, out)) {
       printf("=%g\n", out[0]);
     } else
-      printf( "Update failed: there's something wrong with the structure of the neural net\n"
-              "               check for loops and neurons without inputs\n");
+      printf("Update failed: %s\n", net.GetSchedule()->GetErrorMessage());
   }
 }
 
@@ -1,68 +1,195 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <memory.h>
+#include <float.h>
 #include "GANet.h"
+#include "Dataset.h"
 
-Chromosome::Chromosome(int length) : genecount(length)
+// returns a random index from 0 to size - 1
+static int DrawIndex(int size)
 {
-  genes = new double[genecount];
-  newgenes = new double[genecount];
+  return min((int)Random::GetDouble(0, size), size - 1);
 }
 
-Chromosome::~Chromosome()
+RouletteWheel::RouletteWheel() : size(0), thresholds(null), aliases(null)
 {
-  safe_delete_array(genes);
-  safe_delete_array(newgenes);
-  // genecount = 0;
 }
 
-void Chromosome::SetGenes(WEIGHTFUNCTION weight)
+RouletteWheel::~RouletteWheel()
 {
-  for(int i = 0; i < genecount; i ++)
-    genes[i] = weight();
+  safe_delete_array(thresholds);
+  safe_delete_array(aliases);
 }
 
-void Chromosome::Mutate(double rate, double maxoffset)
+void RouletteWheel::Build(const double *weights, int n)
 {
-  for (int i = 0; i < genecount; i ++) {
-    if (Random::GetDouble() < rate) {
-			//add or subtract a small value to the weight
-      genes[i] += (Random::GetDouble(-1, 1) * maxoffset);
-		}
-	}
+  if(n > size) {
+    safe_delete_array(thresholds);
+    safe_delete_array(aliases);
+    thresholds = new double[n];
+    aliases = new int[n];
+  }
+  size = n;
+
+  double total = 0.0;
+  for(int i = 0; i < size; i ++)
+    total += weights[i];
+
+  // the weights are scaled to an average of 1, the slots whose weight is less than 1
+  // are filled up from a slot with more, which becomes their alias
+  // the indices of the slots with less are kept at the start of the list and the others at the end
+  int *list = new int[size];
+  int less = 0, more = 0;
+  for(int i = 0; i < size; i ++) {
+    thresholds[i] = total > 0.0 ? weights[i] * size / total : 1.0;
+    aliases[i] = i;
+    if(thresholds[i] < 1.0) list[less ++] = i;
+    else list[size - ++ more] = i;
+  }
+
+  while(less > 0 && more > 0) {
+    int small = list[-- less], large = list[size - more];
+    aliases[small] = large;
+    thresholds[large] -= 1.0 - thresholds[small];
+
+    if(thresholds[large] < 1.0) {
+      more --;
+      list[less ++] = large;
+    }
+  }
+
+  // the slots that are left are full, up to rounding
+  while(less > 0) thresholds[list[-- less]] = 1.0;
+  while(more > 0) thresholds[list[size - more --]] = 1.0;
+
+  delete[] list;
+}
+
+int RouletteWheel::Draw()
+{
+  double value = Random::GetDouble(0, size);
+  int i = min((int)value, size - 1);
+  return value - i < thresholds[i] ? i : aliases[i];
+}
+
+Population::Population() : size(0), capacity(0), genecount(0), stride(0),
+  genes(null), newgenes(null), memory(null), newmemory(null), fitness(null)
+{
+}
+
+Population::~Population()
+{
+  Clear();
+}
+
+void Population::Clear()
+{
+  safe_delete_array(memory);
+  safe_delete_array(newmemory);
+  safe_delete_array(fitness);
+  genes = newgenes = null;
+  size = capacity = genecount = stride = 0;
+}
+
+// returns the first address aligned to 64 bytes in memory
+static double* AlignRow(double *memory)
+{
+  return (double *)(((size_t)memory + 63) & ~(size_t)63);
+}
+
+void Population::Reserve(int c)
+{
+  // 8 more doubles leave room for the alignment
+  long long length = (long long)c * stride + 8;
+  double *m = new double[length], *newm = new double[length];
+  double *g = AlignRow(m), *newg = AlignRow(newm);
+  double *f = new double[c];
+
+  if(size > 0) {
+    memcpy(g, genes, (long long)size * stride * sizeof(double));
+    memcpy(f, fitness, size * sizeof(double));
+  }
+
+  safe_delete_array(memory);
+  safe_delete_array(newmemory);
+  safe_delete_array(fitness);
+
+  memory = m;
+  newmemory = newm;
+  genes = g;
+  newgenes = newg;
+  fitness = f;
+  capacity = c;
+}
+
+int Population::Add(int count)
+{
+  if(size == 0) {
+    genecount = count;
+    stride = (genecount + 7) & ~7;
+  }
+
+  if(size == capacity)
+    Reserve(max(16, capacity * 2));
+
+  // the padding at the end of the row is kept at 0
+  memset(GetGenes(size), 0, stride * sizeof(double));
+  memset(GetNewGenes(size), 0, stride * sizeof(double));
+  fitness[size] = 0.0;
+  return size ++;
 }
 
-void Chromosome::Update()
+void Population::Swap()
 {
   double *temp = genes;
   genes = newgenes;
   newgenes = temp;
+
+  temp = memory;
+  memory = newmemory;
+  newmemory = temp;
 }
 
-void Chromosome::CrossOver(Chromosome *ina, Chromosome *inb, 
-                           Chromosome *outa, Chromosome *outb, double rate)
+void Population::Mutate(double rate, double maxoffset)
 {
-  if(ina->genecount != inb->genecount) return;
+  if(rate <= 0.0 || genecount == 0) return;
 
-  if(Random::GetDouble() > rate || ina == inb) {
-    for(int i = 0; i < ina->genecount; i ++) {
-      outa->GetNewGenes()[i] = ina->GetGenes()[i];
-      outb->GetNewGenes()[i] = inb->GetGenes()[i];
-    }
-    return;
+  // the gaps between the mutated genes have a geometric distribution,
+  // the genes are counted through the whole matrix, skipping the padding
+  double scale = rate < 1.0 ? 1.0 / log(1.0 - rate) : 0.0;
+  long long total = (long long)size * genecount;
+
+  for(long long k = 0; ; k ++) {
+    double gap = floor(log(Random::GetDouble(DBL_MIN, 1.0)) * scale);
+    if(gap >= (double)(total - k)) break;
+    k += (long long)gap;
+
+    //add or subtract a small value to the weight
+    genes[k / genecount * stride + k % genecount] += Random::GetDouble(-1, 1) * maxoffset;
   }
+}
 
-  int flippoint = Random::GetInt(ina->genecount + 1);
+void Population::CrossOver(int ina, int inb, int outa, int outb, double rate)
+{
+  const double *a = GetGenes(ina), *b = GetGenes(inb);
+  double *newa = GetNewGenes(outa), *newb = GetNewGenes(outb);
 
-  for(int i = 0; i < flippoint; i ++) {
-    outa->GetNewGenes()[i] = ina->GetGenes()[i];
-    outb->GetNewGenes()[i] = inb->GetGenes()[i];
+  if(Random::GetDouble() > rate || ina == inb) {
+    memcpy(newa, a, genecount * sizeof(double));
+    if(outb != outa) memcpy(newb, b, genecount * sizeof(double));
+    return;
   }
 
-  for(int i = flippoint; i < ina->genecount; i ++) {
-    outa->GetNewGenes()[i] = inb->GetGenes()[i];
-    outb->GetNewGenes()[i] = ina->GetGenes()[i];
+  int flippoint = Random::GetInt(genecount + 1);
+
+  // outb is the same as outa for the last chromosome of an odd population, it gets a's genes
+  if(outb != outa) {
+    memcpy(newb, b, flippoint * sizeof(double));
+    memcpy(newb + flippoint, a + flippoint, (genecount - flippoint) * sizeof(double));
   }
+  memcpy(newa, a, flippoint * sizeof(double));
+  memcpy(newa + flippoint, b + flippoint, (genecount - flippoint) * sizeof(double));
 }
 
 int GATrainer::GetWeightCount(LayeredNet *net)
@@ -77,143 +204,329 @@ int GATrainer::GetWeightCount(LayeredNet *net)
   return i;
 }
 
-void GATrainer::SetWeights(LayeredNet *net, Chromosome *chromosome)
+void GATrainer::SetWeights(LayeredNet *net, const double *genes)
 {
+  const int *synapses = (const int *)synapsegenes.GetBuffer();
   int i = 0;
   forEach(Layer, (*net->GetGroups()), layer) {
     forEach(Neuron, layer->neurons, neuron) {
       forEach(InputSynapse, neuron->inputs, input)
-        input->weight = chromosome->GetGenes()[i ++];
+        input->weight = genes[synapses[i ++]];
     }
   }
 }
 
-void GATrainer::GetWeights(LayeredNet *net, Chromosome *chromosome)
+void GATrainer::GetWeights(LayeredNet *net, double *genes)
 {
+  const int *synapses = (const int *)synapsegenes.GetBuffer();
   int i = 0;
   forEach(Layer, (*net->GetGroups()), layer) {
     forEach(Neuron, layer->neurons, neuron) {
       forEach(InputSynapse, neuron->inputs, input)
-        chromosome->GetGenes()[i ++] = input->weight;
+        genes[synapses[i ++]] = input->weight;
     }
   }
 }
 
-
-void GATrainer::AddNet(LayeredNet *net)
+void GATrainer::LayOutGenes(LayeredNet *net)
 {
-  int weightcount;
-  if(nets.GetSize() == 0)
-    weightcount = GetWeightCount(net);
-  else
-    weightcount = ((Chromosome *)chromosomes.Elements())->GetGeneCount();
+  int count = GetWeightCount(net);
+  int *synapses = (int *)synapsegenes.GetBuffer(count * sizeof(int));
+  int *places = (int *)geneplaces.GetBuffer(count * sizeof(int));
+  int *indices = new int[count];
+
+  // by default each synapse has the gene with its own index
+  bound = false;
+  layoutversion = net->GetTopologyVersion();
+  for(int i = 0; i < count; i ++) {
+    synapses[i] = i;
+    places[i] = -1;
+  }
 
-  nets.Attach(net);
+  CompiledNet layout;
+  if(layout.Compile(net) && layout.GetParameterIndices(net, indices)) {
+    int paramcount = layout.GetParameterCount();
+    int *uses = new int[paramcount];
+    memset(uses, 0, paramcount * sizeof(int));
+    for(int i = 0; i < count; i ++) {
+      if(indices[i] >= 0) uses[indices[i]] ++;
+    }
 
-  if(chromosomes.GetSize() < nets.GetSize()) {
+    // the genes can be the parameters if each parameter belongs to exactly one synapse,
+    // the synapses that aren't compiled get the genes after the parameters
+    bound = true;
+    for(int p = 0; p < paramcount; p ++) {
+      if(uses[p] != 1) bound = false;
+    }
 
-    Chromosome *chromosome = new Chromosome(weightcount);
-    chromosomes.Attach(chromosome);
+    int extra = paramcount;
+    for(int i = 0; i < count; i ++) {
+      if(bound) synapses[i] = indices[i] >= 0 ? indices[i] : extra ++;
+      places[synapses[i]] = indices[i];
+    }
+    delete[] uses;
   }
 
+  delete[] indices;
+}
+
+void GATrainer::StoreWeights()
+{
+  if(!stale) return;
+
+  int j = 0;
+  forEach(LayeredNet, nets, net)
+    SetWeights(net, population.GetGenes(j ++));
+  stale = false;
+}
+
+
+void GATrainer::AddNet(LayeredNet *net)
+{
+  int weightcount;
+  if(population.GetSize() == 0) {
+    weightcount = GetWeightCount(net);
+    LayOutGenes(net);
+  } else
+    weightcount = population.GetGeneCount();
+
+  // the net goes at the end of the list, so its chromosome is the row with the same index
+  // a net already in the list may still have the weights of an older generation
   int index = nets.GetIndex(net);
-  Chromosome *chromosome = (Chromosome *)chromosomes.Get(index);
-  GetWeights(net, chromosome);
+  if(index < 0) {
+    nets.AttachLast(net);
+    index = population.Add(weightcount);
+  } else
+    StoreWeights();
+
+  GetWeights(net, population.GetGenes(index));
 }
 
-double GATrainer::Train(int state)
+bool GATrainer::CompileWorkers(int count)
 {
-  if(nets.GetSize() <= 1) return NetTrainer::TrainError;
+  // all the nets have the same structure, so the first one stands for all of them
+  LayeredNet *net = (LayeredNet *)nets.Elements();
+  if(net == null) return false;
+
+  int version = net->GetTopologyVersion();
+  if(workercount == count && compiledversion == version)
+    return compiled;
+
+  safe_delete_array(workers);
+  workers = new CompiledNet[count];
+  workercount = count;
+  compiledversion = version;
+
+  compiled = GetWeightCount(net) == population.GetGeneCount();
+
+  // the genes follow the parameters of the compiled nets, so if the structure has changed
+  // the chromosomes go through the nets to be laid out again
+  if(compiled && layoutversion != version) {
+    StoreWeights();
+    LayOutGenes(net);
+    int j = 0;
+    forEach(LayeredNet, nets, n)
+      GetWeights(n, population.GetGenes(j ++));
+  }
 
-  input(inputbuffer, state); // generate the given state (the state parameter may be ignored by the network)
-  train(inputbuffer, outputbuffer1);
+  for(int i = 0; i < count && compiled; i ++)
+    compiled = workers[i].Compile(net);
 
-  Chromosome *chromosome = (Chromosome *)chromosomes.Elements();
+  return compiled;
+}
 
-  double netmeanerror = 0.0;
-  int j = 0;
-  forEach(LayeredNet, nets, net) {
-    net->Update(inputbuffer, outputbuffer2);
+// the samples the nets are evaluated on
+struct FitnessSamples
+{
+  GATrainer *trainer;
+  const double *inputs, *targets;
 
-    double meanerror = 0.0;
-    int i = 0;
-    forEach(Neuron, (*net->GetOutputs()), neuron) {
-      double desiredoutput = outputbuffer1[i];
-      double actualoutput = outputbuffer2[i]; // == neuron->GetData();
+  // the number of samples and of nets
+  int n, count;
+};
 
-      meanerror += fabs(desiredoutput - actualoutput);
-      i ++;
+void GATrainer::FitnessTask(void *param, int index, int count)
+{
+  FitnessSamples *task = (FitnessSamples *)param;
+  GATrainer *trainer = task->trainer;
+  Population *population = &trainer->population;
+  int n = task->n, inputcount = trainer->inputcount, outputcount = trainer->outputcount;
+
+  LayeredNet **netlist = (LayeredNet **)trainer->netarray.GetBuffer();
+  double *neterrors = (double *)trainer->errors.GetBuffer();
+  double *outputs = (double *)trainer->outputs.GetBuffer() + (long long)index * n * outputcount;
+
+  int first = (int)((long long)task->count * index / count);
+  int last = (int)((long long)task->count * (index + 1) / count);
+
+  for(int j = first; j < last; j ++) {
+    if(trainer->compiled) {
+      // the genes are the weights of the compiled net, either where they are or added up
+      // where several synapses share a weight
+      CompiledNet *worker = &trainer->workers[index];
+      double *genes = population->GetGenes(j);
+
+      if(trainer->bound)
+        worker->Bind(genes);
+      else {
+        double *params = worker->GetParameters();
+        const int *places = (const int *)trainer->geneplaces.GetBuffer();
+
+        memset(params, 0, worker->GetParameterCount() * sizeof(double));
+        for(int g = 0; g < population->GetGeneCount(); g ++) {
+          if(places[g] >= 0) params[places[g]] += genes[g];
+        }
+      }
+
+      worker->UpdateBatch(task->inputs, n, outputs);
+    } else {
+      for(int r = 0; r < n; r ++)
+        netlist[j]->Update(task->inputs + r * inputcount, outputs + r * outputcount);
     }
 
-    meanerror /= (double)i;
-    netmeanerror += meanerror;
+    double meanerror = 0.0;
+    for(int i = 0; i < n * outputcount; i ++)
+      meanerror += fabs(task->targets[i] - outputs[i]);
+    meanerror /= (double)n * outputcount;
+    neterrors[j] = meanerror;
 
     // translate the error into a fitness score
     // the smaller the error, the greater the score, 
     // the more likely this net will "reproduce"
 
     //TODO make sure this works properly
-    chromosome->Fitness() = exp(1.0 - meanerror);
-
-    chromosome = (Chromosome *)chromosome->Next();
-    j ++;
+    population->Fitness(j) = exp(1.0 - meanerror);
   }
+}
+
+double GATrainer::Train(int state)
+{
+  if(nets.GetSize() <= 1) return NetTrainer::TrainError;
+
+  FitnessSamples task;
+  task.trainer = this;
+  task.n = max(1, samplecount);
+  task.count = nets.GetSize();
+
+  // the samples follow the state, wrapping around at the end of the dataset
+  int *states = (int *)samplestates.GetBuffer((size_t)task.n * sizeof(int));
+  for(int r = 0; r < task.n; r ++)
+    states[r] = dataset != null ? (int)(((long long)state + r) % dataset->GetSize()) : state + r;
+
+  double *inputs = (double *)sampleinputs.GetBuffer((size_t)task.n * inputcount * sizeof(double));
+  double *targets = (double *)sampletargets.GetBuffer((size_t)task.n * outputcount * sizeof(double));
+  GetSamples(states, task.n, inputs, targets, task.inputs, task.targets);
+
+  LayeredNet **netlist = (LayeredNet **)netarray.GetBuffer(task.count * sizeof(LayeredNet *));
+  double *neterrors = (double *)errors.GetBuffer(task.count * sizeof(double));
+
+  int j = 0;
+  forEach(LayeredNet, nets, net)
+    netlist[j ++] = net;
+
+  int taskcount = pool != null ? min(pool->GetThreadCount(), task.count) : 1;
+  outputs.GetBuffer((size_t)taskcount * task.n * outputcount * sizeof(double));
+
+  // nets that can't be compiled are updated with the weights of the current generation
+  if(!CompileWorkers(taskcount))
+    StoreWeights();
+
+  if(taskcount > 1)
+    pool->Run(FitnessTask, &task, taskcount);
+  else
+    FitnessTask(&task, 0, 1);
+
+  // the errors are added up in the same order however many threads there are
+  double netmeanerror = 0.0;
+  for(j = 0; j < task.count; j ++)
+    netmeanerror += neterrors[j];
 
   CreatePopulation();
 
-  netmeanerror /= (double)j;
+  netmeanerror /= (double)task.count;
   return netmeanerror;
 }
 
-double GATrainer::GetFitnessTotal()
+// a chromosome and its fitness, for sorting them
+struct RankedChromosome
 {
-  double total = 0.0;
-  forEach(Chromosome, chromosomes, chromosome)
-    total += chromosome->Fitness();
-  return total;
-}
+  double fitness;
+  int index;
+};
 
-Chromosome* GATrainer::GetChromosome(double value)
+static int CompareRanks(const void *a, const void *b)
 {
-  double total = 0.0;
-  forEach(Chromosome, chromosomes, chromosome) {
-    total += chromosome->Fitness();
-    if(value <= total) return chromosome;
-  }
-
-  return null; 
+  const RankedChromosome *ra = (const RankedChromosome *)a, *rb = (const RankedChromosome *)b;
+  if(ra->fitness != rb->fitness) return ra->fitness < rb->fitness ? -1 : 1;
+  return ra->index - rb->index;
 }
 
-void GATrainer::CreatePopulation()
+void GATrainer::PrepareSelection()
 {
-  double total = GetFitnessTotal();
+  int size = population.GetSize();
 
-  forEach(Chromosome, chromosomes, chromosome) {
-    Chromosome *ina = GetChromosome(Random::GetDouble(0, total));
-    Chromosome *inb = GetChromosome(Random::GetDouble(0, total));
+  if(selection == Roulette)
+    wheel.Build(population.GetFitness(), size);
+  else if(selection == Rank) {
+    RankedChromosome *sorted = (RankedChromosome *)ranks.GetBuffer(size * sizeof(RankedChromosome));
+    double *weights = (double *)rankweights.GetBuffer(size * sizeof(double));
 
-    Chromosome *outa = chromosome;
-    Chromosome *outb = (Chromosome *)chromosome->Next();
-    if(outb == null) outb = outa;
+    for(int i = 0; i < size; i ++) {
+      sorted[i].fitness = population.Fitness(i);
+      sorted[i].index = i;
+    }
+    qsort(sorted, size, sizeof(RankedChromosome), CompareRanks);
 
-    Chromosome::CrossOver(ina, inb, outa, outb, crossoverrate);
+    // the least fit chromosome has a weight of 1 and the fittest one of size
+    for(int i = 0; i < size; i ++)
+      weights[sorted[i].index] = i + 1;
 
-    chromosome = outb;
+    wheel.Build(weights, size);
   }
+}
+
+int GATrainer::SelectChromosome()
+{
+  if(selection != Tournament)
+    return wheel.Draw();
+
+  int best = DrawIndex(population.GetSize());
+  for(int i = 1; i < tournamentsize; i ++) {
+    int j = DrawIndex(population.GetSize());
+    if(population.Fitness(j) > population.Fitness(best)) best = j;
+  }
+  return best;
+}
 
-  Chromosome *newchromosome = (Chromosome *)chromosomes.Elements();
-  forEach(LayeredNet, nets, net) {
-    newchromosome->Update();
-    newchromosome->Mutate(mutationrate, mutationoffset);
-    SetWeights(net, newchromosome);
+void GATrainer::CreatePopulation()
+{
+  PrepareSelection();
+  int size = population.GetSize();
 
-    newchromosome = (Chromosome *)newchromosome->Next();
+  // the next generation is bred two chromosomes at a time
+  for(int i = 0; i < size; i += 2) {
+    int ina = SelectChromosome();
+    int inb = SelectChromosome();
+
+    population.CrossOver(ina, inb, i, min(i + 1, size - 1), crossoverrate);
   }
 
+  population.Swap();
+  population.Mutate(mutationrate, mutationoffset);
+
+  // the nets get the new genes when they're needed
+  stale = true;
 }
 
 GATrainer::GATrainer(int inputcount, int outputcount) : NetTrainer(inputcount, outputcount),
-  mutationrate(0), mutationoffset(0), crossoverrate(0)
+  pool(null), samplecount(1), workers(null), workercount(0), compiled(false), compiledversion(-1),
+  layoutversion(-1), bound(false), stale(false),
+  mutationrate(0), mutationoffset(0), crossoverrate(0), selection(Roulette), tournamentsize(2)
+{
+}
+
+GATrainer::~GATrainer()
 {
+  safe_delete_array(workers);
 }
 
@@ -1,52 +1,146 @@
 #pragma once
 
-#include "NeuralNet.h"
+#include "CompiledNet.h"
 
-class Chromosome : public Element
+// a roulette wheel, which draws an index with a chance proportional to its weight
+// it's built once in linear time and then draws in constant time with
+// Walker's alias method, each slot of the wheel has the same chance and holds
+// at most two indices, its own and an alias, split at a threshold
+class RouletteWheel
 {
-  int genecount;
+protected:
+  int size;
+  double *thresholds;
+  int *aliases;
+
+public:
+  inline int GetSize() { return size; }
+
+  // builds the wheel for size weights, which mustn't be negative
+  // if they're all 0 each index has the same chance
+  void Build(const double *weights, int size);
+
+  // draws an index
+  int Draw();
+
+  RouletteWheel();
+  ~RouletteWheel();
+};
+
+// the genes of a population of chromosomes, one for each net of a GATrainer
+// the genes are stored in two matrices with a row for each chromosome, the current
+// generation and the next one, which is bred from the current one and then
+// takes its place by swapping the pointers
+// the rows are aligned to 64 bytes, so they start on a cache line
+class Population
+{
+protected:
+  int size, capacity, genecount, stride;
+
+  // the current and the next generation, and the memory they're in
   double *genes, *newgenes;
+  double *memory, *newmemory;
+
+  double *fitness;
 
-  double fitness;
+  // makes room for capacity chromosomes, keeping the current generation
+  void Reserve(int capacity);
 
 public:
+  // the number of chromosomes and of genes in each of them
+  inline int GetSize() { return size; }
+  inline int GetGeneCount() { return genecount; }
 
-  void SetGenes(WEIGHTFUNCTION weight);
+  // the distance between two rows of the matrices in doubles
+  inline int GetStride() { return stride; }
 
-  inline int GetGeneCount() { return genecount; }
-  inline double* GetGenes() { return genes; }
-  inline double* GetNewGenes() { return genes; }
+  // the genes of a chromosome in the current and in the next generation
+  inline double* GetGenes(int i) { return genes + (long long)i * stride; }
+  inline double* GetNewGenes(int i) { return newgenes + (long long)i * stride; }
 
-  inline double& Fitness() { return fitness; }
+  // the fitness of a chromosome of the current generation
+  inline double& Fitness(int i) { return fitness[i]; }
+  inline double* GetFitness() { return fitness; }
 
-  // mutates this Chromosome
-  void Mutate(double rate, double maxoffset);
+  // adds a chromosome to the end of the population and returns its index
+  // all the chromosomes have the same number of genes, which is set by the first one
+  // its genes are left to be set
+  int Add(int genecount);
 
-  // "copies" newgenes to genes by swapping the pointers
-  void Update();
+  // removes all the chromosomes
+  void Clear();
 
-  // uses two parent chromosome to produce offspring
-  // 2 chromosomes are produced, with the new genes stored
-  // in newgenes of outa and outb
-  // rate is the crossover rate, that is the chance that the genes
-  // of the parent chromosomes are mixed
-  static void CrossOver(Chromosome *ina, Chromosome *inb, 
-                        Chromosome *outa, Chromosome *outb, double rate);
+  // makes the next generation the current one by swapping the matrices
+  void Swap();
 
-  // creates a Chromosomes with the specified number of genes
-  Chromosome(int length);
+  // mutates the genes of the current generation, each one with the chance of rate,
+  // by adding a random value between -maxoffset and maxoffset to it
+  // instead of drawing a random number for each gene the distance to the next
+  // mutated gene is drawn, so only the genes that mutate cost anything
+  void Mutate(double rate, double maxoffset);
+
+  // breeds two chromosomes of the next generation, outa and outb, from two of the current one,
+  // ina and inb, whose genes are copied, with the chance of rate they are crossed over
+  // by swapping the genes after a random point
+  void CrossOver(int ina, int inb, int outa, int outb, double rate);
 
-  // frees the gene arrays
-  ~Chromosome();
+  Population();
+  ~Population();
 };
 
 class GATrainer : public NetTrainer
 {
 protected:
 
-  CleanContainer chromosomes;
+  Population population;
   Container nets;
 
+  // the pool evaluating the nets, see SetThreadPool
+  ThreadPool *pool;
+
+  // the nets in an array for the tasks and the error of each net
+  MemoryBuffer netarray, errors;
+
+  // the outputs of the nets for all the samples, one block of rows for each task
+  MemoryBuffer outputs;
+
+  // the samples a generation is evaluated on, see SampleCount
+  int samplecount;
+  MemoryBuffer samplestates, sampleinputs, sampletargets;
+
+  // the compiled nets the chromosomes are evaluated with, one for each task
+  CompiledNet *workers;
+  int workercount;
+
+  // whether the workers could be compiled and the topology version they were compiled for
+  bool compiled;
+  int compiledversion;
+
+  // the gene of each synapse, taking the synapses layer by layer, neuron by neuron,
+  // in the order of their inputs, and the place of each gene in the parameters
+  // of the compiled nets or -1, see CompiledNet::GetParameterIndices
+  // and the topology version of the first net they were laid out for
+  MemoryBuffer synapsegenes, geneplaces;
+  int layoutversion;
+
+  // true if the genes are laid out like the parameters of the compiled nets,
+  // which then use the chromosomes as their weights, see IsBound
+  bool bound;
+
+  // true if the nets don't have the weights of the current generation yet, see StoreWeights
+  bool stale;
+
+  // works out where the weights of the nets go in the chromosomes, from the first net
+  void LayOutGenes(LayeredNet *net);
+
+  // compiles a worker for each of count tasks from the first net, unless they're already compiled
+  // the genes are laid out again if the structure of the net has changed since AddNet
+  // returns false if the nets can't be compiled
+  bool CompileWorkers(int count);
+
+  // the task run by the pool, it gets the FitnessSamples describing the samples
+  static void FitnessTask(void *param, int index, int count);
+
   double mutationrate;
   double mutationoffset;
   double crossoverrate;
@@ -54,21 +148,29 @@ protected:
   // get the number of weights in a net
   static int GetWeightCount(LayeredNet *net);
 
-  // transfers the data from a chromosome to a net
-  static void SetWeights(LayeredNet *net, Chromosome *chromosome);
+  // transfers the genes of a chromosome to a net
+  void SetWeights(LayeredNet *net, const double *genes);
+
+  // transfers the weights of the net to the genes of a chromosome
+  void GetWeights(LayeredNet *net, double *genes);
 
-  // transfers the data from the net to a chromosome
-  static void GetWeights(LayeredNet *net, Chromosome *chromosome);
+  // how the parents of the next generation are selected, see SelectionType
+  int selection, tournamentsize;
 
-  // returns the sum of fitness values of all the Chromosomes
-  double GetFitnessTotal();
+  // the wheel of the roulette and the rank selections
+  RouletteWheel wheel;
 
-  // returns a Chromosome by roulette wheel selection
-  // value must be between 0 and FitnessTotal
-  Chromosome* GetChromosome(double value);
+  // the chromosomes sorted by fitness and their weights for the rank selection
+  MemoryBuffer ranks, rankweights;
+
+  // gets the selection ready for the fitness values of the current generation
+  void PrepareSelection();
+
+  // returns the index of a chromosome selected as a parent
+  int SelectChromosome();
 
   // creates a new population one from the existing one
-  // the fitness values of the Chromosomes are used
+  // the fitness values of the chromosomes are used
   void CreatePopulation();
 
 public:
@@ -85,19 +187,70 @@ public:
   // 0.7 is a good starting value
   inline double& CrossOverRate() { return crossoverrate; }
 
-  // adds a new net to the population
+  // the ways of selecting the parents of the next generation
+  // Roulette picks each chromosome with a chance proportional to its fitness
+  // Rank sorts the chromosomes by fitness and picks the n-th worst with a chance
+  // proportional to n, so a few much fitter chromosomes don't take over the population
+  // Tournament picks a few chromosomes at random and takes the fittest, see TournamentSize
+  // all of them take constant time for each parent once the generation is evaluated
+  enum SelectionType { Roulette, Rank, Tournament };
+
+  // the selection, Roulette by default
+  inline int& Selection() { return selection; }
+
+  // the number of chromosomes in a tournament, 2 by default
+  // the larger it is the more the fitter chromosomes are favored
+  inline int& TournamentSize() { return tournamentsize; }
+
+  // adds a new net to the population, its weights become its chromosome
+  // a net that is already in the population gets its chromosome replaced by its weights,
+  // which are those of the current generation unless they have been changed since GetNets
   void AddNet(LayeredNet *net);
     
-  // removes (deletes) all the nets the trainer contains
-  inline void RemoveNets() { nets.Empty(); }
+  // removes (deletes) all the nets the trainer contains and their chromosomes
+  inline void RemoveNets() { nets.Empty(); population.Clear(); stale = false; compiledversion = layoutversion = -1; }
 
-  // returns the net population
-  inline Container* GetNets() { return &nets; }
+  // returns the net population, with the weights of the current generation
+  inline Container* GetNets() { StoreWeights(); return &nets; }
+
+  // returns the chromosomes of the nets, the i-th row belongs to the i-th net
+  inline Population* GetPopulation() { return &population; }
+
+  // returns true if the genes of a chromosome are the weights and biases of the compiled
+  // nets, in the same order, see CompiledNet::GetParameters, followed by the biases
+  // of the input layer, which aren't compiled
+  // the compiled nets are then bound to the chromosomes instead of getting a copy of their
+  // genes, and a chromosome can be trained further by BPTrainer::Bind
+  // this is the case if each weight of the compiled nets belongs to exactly one synapse
+  inline bool IsBound() { return bound; }
+
+  // copies the genes of the current generation to the nets
+  // the nets aren't used by Train when they're compiled, so it only copies the genes
+  // when they're needed, when GetNets is called for instance
+  void StoreWeights();
+
+  // the number of samples each net is evaluated on in a generation, 1 by default
+  // Train(state) takes the samples state to state + count - 1, which wrap around
+  // at the end of a dataset, and the fitness comes from the mean error over all of them
+  // a single sample makes the fitness very noisy
+  inline int& SampleCount() { return samplecount; }
 
   // trains (= evolves) a new generation
+  // the nets are compiled and the chromosomes are evaluated straight from the population,
+  // all the samples at once, without going through the neurons of the nets,
+  // nets that can't be compiled are updated one sample at a time
+  // returns the mean error of the nets
   double Train(int state);
 
+  // spreads the evaluation of the nets over the threads of the pool
+  // each net is evaluated on its own, so the fitness values are the same
+  // as on a single thread and with Random::Seed the whole run can be repeated
+  // a null pool evaluates them on the calling thread, which is the default
+  inline void SetThreadPool(ThreadPool *pool) { this->pool = pool; }
+  inline ThreadPool* GetThreadPool() { return pool; }
+
   // creates a trainer
   GATrainer(int inputcount, int outputcount);
+  ~GATrainer();
 };
 
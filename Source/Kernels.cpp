@@ -0,0 +1,277 @@
+#include <math.h>
+#include <memory.h>
+#include "Kernels.h"
+
+#if defined(KERNELS_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+// the scalar kernels work on every processor
+namespace ScalarKernels
+{
+  struct V
+  {
+    typedef double real;
+    typedef double type;
+    enum { width = 1 };
+
+    static inline type Zero() { return 0.0; }
+    static inline type Load(const double *p) { return *p; }
+    static inline type Set(double x) { return x; }
+    static inline void Store(double *p, type a) { *p = a; }
+    static inline type Sub(type a, type b) { return a - b; }
+    static inline type Mul(type a, type b) { return a * b; }
+    static inline type Div(type a, type b) { return a / b; }
+    static inline type Min(type a, type b) { return a < b ? a : b; }
+    static inline type Max(type a, type b) { return a > b ? a : b; }
+    static inline type Sqrt(type a) { return sqrt(a); }
+    static inline type Step(type a) { return a > 0.0 ? 1.0 : 0.0; }
+
+    static inline type Pow2(type t)
+    {
+      unsigned long long bits;
+      memcpy(&bits, &t, sizeof(bits));
+      bits = (bits << 52) + 0x3ff0000000000000ULL;
+      memcpy(&t, &bits, sizeof(t));
+      return t;
+    }
+
+    static inline type Add(type a, type b) { return a + b; }
+    static inline type MulAdd(type a, type b, type c) { return a * b + c; }
+    static inline double Sum(type a) { return a; }
+  };
+
+  #include "Kernels.inl"
+}
+
+namespace ScalarFloatKernels
+{
+  struct V
+  {
+    typedef float real;
+    typedef float type;
+    enum { width = 1 };
+
+    static inline type Zero() { return 0.0f; }
+    static inline type Load(const float *p) { return *p; }
+    static inline type Set(float x) { return x; }
+    static inline void Store(float *p, type a) { *p = a; }
+    static inline type Sub(type a, type b) { return a - b; }
+    static inline type Mul(type a, type b) { return a * b; }
+    static inline type Div(type a, type b) { return a / b; }
+    static inline type Min(type a, type b) { return a < b ? a : b; }
+    static inline type Max(type a, type b) { return a > b ? a : b; }
+    static inline type Sqrt(type a) { return sqrtf(a); }
+    static inline type Step(type a) { return a > 0.0f ? 1.0f : 0.0f; }
+
+    static inline type Pow2(type t)
+    {
+      unsigned int bits;
+      memcpy(&bits, &t, sizeof(bits));
+      bits = (bits << 23) + 0x3f800000U;
+      memcpy(&t, &bits, sizeof(t));
+      return t;
+    }
+
+    static inline type Add(type a, type b) { return a + b; }
+    static inline type MulAdd(type a, type b, type c) { return a * b + c; }
+    static inline float Sum(type a) { return a; }
+  };
+
+  #include "Kernels.inl"
+}
+
+namespace ScalarKernels
+{
+  int QuantizedDot(const signed char *a, const signed char *b, int n)
+  {
+    int sum = 0;
+    for(int i = 0; i < n; i ++)
+      sum += a[i] * b[i];
+    return sum;
+  }
+}
+
+// the exact transfer functions call the C library, just like the Neuron ones
+// the float versions are computed with doubles and rounded
+
+template<class real> static void LinearTransfer(real *, int)
+{
+}
+
+template<class real> static void ExactSigmoid(real *data, int n)
+{
+  for(int i = 0; i < n; i ++)
+    data[i] = (real)(1.0/(1.0 + exp(-(double)data[i])));
+}
+
+template<class real> static void ExactTanh(real *data, int n)
+{
+  for(int i = 0; i < n; i ++)
+    data[i] = (real)tanh((double)data[i]);
+}
+
+template<class real> static void ExactSoftmax(real *data, int n)
+{
+  double largest = data[0];
+  for(int i = 1; i < n; i ++)
+    largest = max(largest, (double)data[i]);
+
+  double sum = 0.0;
+  for(int i = 0; i < n; i ++)
+    sum += exp((double)data[i] - largest);
+
+  for(int i = 0; i < n; i ++)
+    data[i] = (real)(exp((double)data[i] - largest) / sum);
+}
+
+Kernels Kernels::initializer;
+
+int Kernels::set = Kernels::Scalar;
+bool Kernels::fast = false;
+
+Kernels::Functions<double> Kernels::Double = {
+  ScalarKernels::Dot,
+  ScalarKernels::Gemv,
+  ScalarKernels::Gemm,
+  {
+    LinearTransfer<double>,
+    ScalarKernels::Apply<ScalarKernels::Step>,
+    ExactSigmoid<double>,
+    ExactTanh<double>,
+    ScalarKernels::Apply<ScalarKernels::Relu>
+  },
+  ExactSoftmax<double>,
+  ScalarKernels::MomentumStep,
+  ScalarKernels::RMSPropStep,
+  ScalarKernels::AdamStep
+};
+
+int (*Kernels::QuantizedDot)(const signed char *a, const signed char *b, int n) = ScalarKernels::QuantizedDot;
+
+Kernels::Functions<float> Kernels::Float = {
+  ScalarFloatKernels::Dot,
+  ScalarFloatKernels::Gemv,
+  ScalarFloatKernels::Gemm,
+  {
+    LinearTransfer<float>,
+    ScalarFloatKernels::Apply<ScalarFloatKernels::Step>,
+    ExactSigmoid<float>,
+    ExactTanh<float>,
+    ScalarFloatKernels::Apply<ScalarFloatKernels::Relu>
+  },
+  ExactSoftmax<float>,
+  ScalarFloatKernels::MomentumStep,
+  ScalarFloatKernels::RMSPropStep,
+  ScalarFloatKernels::AdamStep
+};
+
+void Kernels::UseScalar()
+{
+  USE_KERNELS(Double, ScalarKernels);
+  USE_KERNELS(Float, ScalarFloatKernels);
+  QuantizedDot = ScalarKernels::QuantizedDot;
+}
+
+#ifndef KERNELS_X86
+// the vector kernels are only available on x86 processors
+void Kernels::UseSSE2() {}
+void Kernels::UseAVX2() {}
+void Kernels::UseAVX512() {}
+#endif
+
+bool Kernels::IsSupported(int set)
+{
+  if(set == Scalar) return true;
+
+#if defined(KERNELS_X86) && defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  int maxleaf = info[0];
+
+  __cpuid(info, 1);
+  bool sse2 = (info[3] & (1 << 26)) != 0;
+  bool fma = (info[2] & (1 << 12)) != 0;
+
+  // the operating system has to save the wider registers as well
+  unsigned __int64 xcr0 = (info[2] & (1 << 27)) != 0 ? _xgetbv(0) : 0;
+
+  bool avx2 = false, avx512 = false;
+  if(maxleaf >= 7) {
+    __cpuidex(info, 7, 0);
+    avx2 = (info[1] & (1 << 5)) != 0;
+    avx512 = (info[1] & (1 << 16)) != 0;
+  }
+
+  switch(set) {
+    case SSE2: return sse2;
+    case AVX2: return avx2 && fma && (xcr0 & 0x06) == 0x06;
+    case AVX512: return avx512 && (xcr0 & 0xe6) == 0xe6;
+  }
+#elif defined(KERNELS_X86) && defined(__GNUC__)
+  __builtin_cpu_init();
+
+  switch(set) {
+    case SSE2: return __builtin_cpu_supports("sse2") != 0;
+    case AVX2: return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case AVX512: return __builtin_cpu_supports("avx512f") != 0;
+  }
+#endif
+
+  return false;
+}
+
+bool Kernels::Select(int s)
+{
+  if(s < 0 || s >= InstructionSetCount || !IsSupported(s))
+    return false;
+
+  switch(s) {
+    case Scalar: UseScalar(); break;
+    case SSE2: UseSSE2(); break;
+    case AVX2: UseAVX2(); break;
+    case AVX512: UseAVX512(); break;
+  }
+
+  if(!fast) {
+    Double.Transfer[Sigmoid] = ExactSigmoid<double>;
+    Double.Transfer[Tanh] = ExactTanh<double>;
+    Float.Transfer[Sigmoid] = ExactSigmoid<float>;
+    Float.Transfer[Tanh] = ExactTanh<float>;
+    Double.Softmax = ExactSoftmax<double>;
+    Float.Softmax = ExactSoftmax<float>;
+  }
+
+  set = s;
+  return true;
+}
+
+void Kernels::SetFastTransfers(bool f)
+{
+  fast = f;
+  Select(set);
+}
+
+void Kernels::SelectBest()
+{
+  for(int s = InstructionSetCount - 1; s >= Scalar; s --) {
+    if(Select(s)) break;
+  }
+}
+
+const char* Kernels::GetName(int set)
+{
+  switch(set) {
+    case Scalar: return "Scalar";
+    case SSE2: return "SSE2";
+    case AVX2: return "AVX2";
+    case AVX512: return "AVX-512";
+  }
+  return "Unknown";
+}
+
+Kernels::Kernels()
+{
+  SelectBest();
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "Util.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define KERNELS_X86
+#endif
+
+// dense linear algebra kernels used by the compiled nets
+
+// there is a version of every kernel for each instruction set, working
+// either on doubles or on floats, which fit twice as many numbers in a vector
+// the widest set supported by the processor is selected at startup
+// Select can be used to force a specific set, for testing for instance
+
+class Kernels
+{
+  static Kernels initializer;
+
+  static int set;
+  static bool fast;
+
+  // set the kernels for the given instruction set
+  // each one is defined in its own file, compiled for that instruction set
+  static void UseScalar();
+  static void UseSSE2();
+  static void UseAVX2();
+  static void UseAVX512();
+
+public:
+
+  enum InstructionSet { Scalar, SSE2, AVX2, AVX512, InstructionSetCount };
+
+  // the transfer functions that have kernels, see Neuron
+  enum TransferFunction { Linear, Step, Sigmoid, Tanh, Relu, TransferFunctionCount };
+
+  // the kernels for one type of numbers, there is a set for doubles and one for floats
+  template<class real> struct Functions
+  {
+    // returns the dot product of a and b
+    real (*Dot)(const real *a, const real *b, int n);
+
+    // adds the product of the m by k matrix of weights and the vector x to the vector y
+    void (*Gemv)(const real *weights, int m, int k, const real *x, real *y);
+
+    // adds the product of the n by k matrix x and the transposed m by k matrix of weights
+    // to the n by m matrix y, xstride and ystride are the distances between the rows of x and y
+    void (*Gemm)(const real *x, int xstride, int n, int k,
+                 const real *weights, int m, real *y, int ystride);
+
+    // the transfer functions applied to each of the n elements in data, indexed by TransferFunction
+    // in exact mode the sigmoid and tanh kernels give the same results as the
+    // Neuron transfer functions, in fast mode they use a polynomial approximation
+    // of exp that is evaluated with vector instructions
+    // for doubles the relative error of the approximation is below 1e-8, which makes the
+    // absolute error of the sigmoid below 3e-9 and that of the tanh below 5e-9
+    // for floats the errors are within a few units in the last place, below 1e-6
+    void (*Transfer[TransferFunctionCount])(real *data, int n);
+
+    // replaces the n elements of data by their softmax, exp(x) divided by the sum of them all
+    // the largest element is subtracted first so that exp can't overflow
+    // exact and fast like the transfer functions
+    void (*Softmax)(real *data, int n);
+
+    // the steps of the optimizers on n parameters, see Optimizer
+    // the gradients are multiplied by scale before they are used
+    void (*MomentumStep)(real *params, const real *gradients, real *velocity, int n,
+                         real rate, real scale, real momentum);
+    void (*RMSPropStep)(real *params, const real *gradients, real *squares, int n,
+                        real rate, real scale, real decay, real epsilon);
+    void (*AdamStep)(real *params, const real *gradients, real *moments, real *squares, int n,
+                     real rate, real scale, real beta1, real beta2, real epsilon);
+  };
+
+  static Functions<double> Double;
+  static Functions<float> Float;
+
+  // returns the kernels for the type of numbers the argument points to
+  inline static Functions<double>& Get(const double *) { return Double; }
+  inline static Functions<float>& Get(const float *) { return Float; }
+
+  // returns the dot product of two vectors of 8 bit integers, summed up in 32 bits
+  // used by the quantized nets, see QuantizedNet
+  static int (*QuantizedDot)(const signed char *a, const signed char *b, int n);
+
+  // returns true if the processor supports the given instruction set
+  static bool IsSupported(int set);
+
+  // selects the kernels for the given instruction set
+  // returns false if the processor doesn't support it
+  static bool Select(int set);
+
+  // selects the widest instruction set supported by the processor
+  static void SelectBest();
+
+  // returns the instruction set in use
+  inline static int GetInstructionSet() { return set; }
+
+  // switches between the fast and the exact transfer functions
+  // the exact ones are used by default
+  static void SetFastTransfers(bool fast);
+  inline static bool GetFastTransfers() { return fast; }
+
+  // returns the name of an instruction set
+  static const char* GetName(int set);
+
+  Kernels();
+};
+
+// sets the kernels to the ones generated from Kernels.inl in a namespace,
+// used by the files implementing each instruction set
+#define USE_KERNELS(functions, kernels) \
+  functions.Dot = kernels::Dot; \
+  functions.Gemv = kernels::Gemv; \
+  functions.Gemm = kernels::Gemm; \
+  functions.Transfer[Step] = kernels::Apply<kernels::Step>; \
+  functions.Transfer[Relu] = kernels::Apply<kernels::Relu>; \
+  functions.Transfer[Sigmoid] = kernels::Apply<kernels::FastSigmoid>; \
+  functions.Transfer[Tanh] = kernels::Apply<kernels::FastTanh>; \
+  functions.Softmax = kernels::Softmax; \
+  functions.MomentumStep = kernels::MomentumStep; \
+  functions.RMSPropStep = kernels::RMSPropStep; \
+  functions.AdamStep = kernels::AdamStep;
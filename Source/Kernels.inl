@@ -0,0 +1,332 @@
+// generic versions of the kernels, see Kernels.h
+
+// this file is included by Kernels.cpp and the files implementing the kernels
+// for each instruction set, inside a namespace of their own and after defining
+// a vector type V with the following members:
+//   real         the type of numbers in the vector, double or float
+//   type         the vector type
+//   width        the number of numbers in a vector
+//   Zero()       returns a vector with all the elements set to zero
+//   Set(x)       returns a vector with all the elements set to x
+//   Load(p)      loads a vector from p, p doesn't need to be aligned
+//   Store(p, a)  stores a to p, p doesn't need to be aligned
+//   Add(a, b)    returns a + b
+//   Sub(a, b)    returns a - b
+//   Mul(a, b)    returns a * b
+//   Div(a, b)    returns a / b
+//   MulAdd(a, b, c) returns a * b + c
+//   Min(a, b), Max(a, b) return the smaller and larger elements of a and b
+//   Sqrt(a)      returns the square roots of the elements of a
+//   Step(a)      returns 1 for the positive elements of a and 0 for the rest
+//   Pow2(t)      returns 2^n, where n is an integer stored in the low bits of
+//                the mantissa of t, see Exp
+//   Sum(a)       returns the sum of all the elements in a
+
+// the number of weights in a panel of rows that is multiplied with all the samples
+// in a batch before moving on to the next panel, small enough to stay in the cache
+static const int PanelSize = 16384;
+
+V::real Dot(const V::real *a, const V::real *b, int n)
+{
+  V::type s0 = V::Zero(), s1 = V::Zero();
+
+  int i = 0;
+  for(; i + 2 * V::width <= n; i += 2 * V::width) {
+    s0 = V::MulAdd(V::Load(a + i), V::Load(b + i), s0);
+    s1 = V::MulAdd(V::Load(a + i + V::width), V::Load(b + i + V::width), s1);
+  }
+  for(; i + V::width <= n; i += V::width)
+    s0 = V::MulAdd(V::Load(a + i), V::Load(b + i), s0);
+
+  V::real sum = V::Sum(V::Add(s0, s1));
+  for(; i < n; i ++)
+    sum += a[i] * b[i];
+  return sum;
+}
+
+// four rows of weights share each load of x
+void Gemv(const V::real *weights, int m, int k, const V::real *x, V::real *y)
+{
+  int j = 0;
+  for(; j + 4 <= m; j += 4) {
+    const V::real *w0 = weights + j * k, *w1 = w0 + k, *w2 = w1 + k, *w3 = w2 + k;
+    V::type s0 = V::Zero(), s1 = V::Zero(), s2 = V::Zero(), s3 = V::Zero();
+
+    int i = 0;
+    for(; i + V::width <= k; i += V::width) {
+      V::type v = V::Load(x + i);
+      s0 = V::MulAdd(V::Load(w0 + i), v, s0);
+      s1 = V::MulAdd(V::Load(w1 + i), v, s1);
+      s2 = V::MulAdd(V::Load(w2 + i), v, s2);
+      s3 = V::MulAdd(V::Load(w3 + i), v, s3);
+    }
+
+    V::real t0 = V::Sum(s0), t1 = V::Sum(s1), t2 = V::Sum(s2), t3 = V::Sum(s3);
+    for(; i < k; i ++) {
+      t0 += w0[i] * x[i];
+      t1 += w1[i] * x[i];
+      t2 += w2[i] * x[i];
+      t3 += w3[i] * x[i];
+    }
+
+    y[j] += t0;
+    y[j + 1] += t1;
+    y[j + 2] += t2;
+    y[j + 3] += t3;
+  }
+
+  for(; j < m; j ++)
+    y[j] += Dot(weights + j * k, x, k);
+}
+
+// the weights are processed in panels that stay in the cache while all the samples
+// pass through them, within a panel four samples and two rows of weights are
+// handled at once so that every load is used for several multiplications
+void Gemm(const V::real *x, int xstride, int n, int k,
+          const V::real *weights, int m, V::real *y, int ystride)
+{
+  int panel = max(2, PanelSize / max(k, 1));
+
+  for(int first = 0; first < m; first += panel) {
+    int last = min(m, first + panel);
+
+    int r = 0;
+    for(; r + 4 <= n; r += 4) {
+      const V::real *x0 = x + (size_t)r * xstride, *x1 = x0 + xstride, *x2 = x1 + xstride, *x3 = x2 + xstride;
+      V::real *y0 = y + (size_t)r * ystride, *y1 = y0 + ystride, *y2 = y1 + ystride, *y3 = y2 + ystride;
+
+      int j = first;
+      for(; j + 2 <= last; j += 2) {
+        const V::real *wa = weights + j * k, *wb = wa + k;
+        V::type a0 = V::Zero(), a1 = V::Zero(), a2 = V::Zero(), a3 = V::Zero();
+        V::type b0 = V::Zero(), b1 = V::Zero(), b2 = V::Zero(), b3 = V::Zero();
+
+        int i = 0;
+        for(; i + V::width <= k; i += V::width) {
+          V::type va = V::Load(wa + i), vb = V::Load(wb + i), v;
+          v = V::Load(x0 + i); a0 = V::MulAdd(va, v, a0); b0 = V::MulAdd(vb, v, b0);
+          v = V::Load(x1 + i); a1 = V::MulAdd(va, v, a1); b1 = V::MulAdd(vb, v, b1);
+          v = V::Load(x2 + i); a2 = V::MulAdd(va, v, a2); b2 = V::MulAdd(vb, v, b2);
+          v = V::Load(x3 + i); a3 = V::MulAdd(va, v, a3); b3 = V::MulAdd(vb, v, b3);
+        }
+
+        V::real sa0 = V::Sum(a0), sa1 = V::Sum(a1), sa2 = V::Sum(a2), sa3 = V::Sum(a3);
+        V::real sb0 = V::Sum(b0), sb1 = V::Sum(b1), sb2 = V::Sum(b2), sb3 = V::Sum(b3);
+        for(; i < k; i ++) {
+          sa0 += wa[i] * x0[i]; sb0 += wb[i] * x0[i];
+          sa1 += wa[i] * x1[i]; sb1 += wb[i] * x1[i];
+          sa2 += wa[i] * x2[i]; sb2 += wb[i] * x2[i];
+          sa3 += wa[i] * x3[i]; sb3 += wb[i] * x3[i];
+        }
+
+        y0[j] += sa0; y0[j + 1] += sb0;
+        y1[j] += sa1; y1[j + 1] += sb1;
+        y2[j] += sa2; y2[j + 1] += sb2;
+        y3[j] += sa3; y3[j + 1] += sb3;
+      }
+
+      for(; j < last; j ++) {
+        const V::real *w = weights + j * k;
+        y0[j] += Dot(w, x0, k);
+        y1[j] += Dot(w, x1, k);
+        y2[j] += Dot(w, x2, k);
+        y3[j] += Dot(w, x3, k);
+      }
+    }
+
+    for(; r < n; r ++)
+      Gemv(weights + first * k, last - first, k, x + (size_t)r * xstride, y + (size_t)r * ystride + first);
+  }
+}
+
+// fast exp, x = n * ln(2) + r with n an integer and |r| <= ln(2) / 2
+// so exp(x) = 2^n * exp(r) where exp(r) is approximated by its Taylor series
+// up to r^7, the relative error is below 1e-8 for doubles
+// and within a few units in the last place for floats
+// x has to be between -Limit and Limit
+static const V::real Limit = sizeof(V::real) == sizeof(float) ? 87.0 : 700.0;
+
+inline V::type Exp(V::type x)
+{
+  // adding 1.5 * 2^52, or 1.5 * 2^23 for floats, rounds x / ln(2) to an integer
+  // stored in the low mantissa bits
+  const V::real shifter = sizeof(V::real) == sizeof(float) ? 12582912.0 : 6755399441055744.0;
+  V::type t = V::MulAdd(x, V::Set(1.4426950408889634), V::Set(shifter));
+  V::type n = V::Sub(t, V::Set(shifter));
+
+  // ln(2) is split into two parts so that r is accurate, the first part has
+  // few enough bits that multiplying it by n is exact
+  const V::real ln2high = sizeof(V::real) == sizeof(float) ? 6.93145751953125e-01 : 6.93147180369123816490e-01;
+  const V::real ln2low = sizeof(V::real) == sizeof(float) ? 1.42860682030941723212e-06 : 1.90821492927058770002e-10;
+  V::type r = V::MulAdd(n, V::Set(-ln2high), x);
+  r = V::MulAdd(n, V::Set(-ln2low), r);
+
+  V::type p = V::Set(1.0 / 5040.0);
+  p = V::MulAdd(p, r, V::Set(1.0 / 720.0));
+  p = V::MulAdd(p, r, V::Set(1.0 / 120.0));
+  p = V::MulAdd(p, r, V::Set(1.0 / 24.0));
+  p = V::MulAdd(p, r, V::Set(1.0 / 6.0));
+  p = V::MulAdd(p, r, V::Set(0.5));
+  p = V::MulAdd(p, r, V::Set(1.0));
+  p = V::MulAdd(p, r, V::Set(1.0));
+
+  return V::Mul(p, V::Pow2(t));
+}
+
+inline V::type Clamp(V::type x)
+{
+  return V::Min(V::Max(x, V::Set(-Limit)), V::Set(Limit));
+}
+
+// 1 / (1 + exp(-x))
+inline V::type FastSigmoid(V::type x)
+{
+  V::type e = Exp(Clamp(V::Sub(V::Zero(), x)));
+  return V::Div(V::Set(1.0), V::Add(V::Set(1.0), e));
+}
+
+// 1 - 2 / (1 + exp(2x))
+inline V::type FastTanh(V::type x)
+{
+  V::type e = Exp(Clamp(V::Add(x, x)));
+  return V::Sub(V::Set(1.0), V::Div(V::Set(2.0), V::Add(V::Set(1.0), e)));
+}
+
+inline V::type Relu(V::type x)
+{
+  return V::Max(x, V::Zero());
+}
+
+inline V::type Step(V::type x)
+{
+  return V::Step(x);
+}
+
+// applies F to the n elements of data, the elements left over at the end
+// are copied to a buffer that is a whole vector wide
+template<V::type (*F)(V::type)> void Apply(V::real *data, int n)
+{
+  int i = 0;
+  for(; i + V::width <= n; i += V::width)
+    V::Store(data + i, F(V::Load(data + i)));
+
+  if(i < n) {
+    V::real buffer[V::width];
+    for(int j = 0; j < V::width; j ++)
+      buffer[j] = i + j < n ? data[i + j] : 0;
+
+    V::Store(buffer, F(V::Load(buffer)));
+
+    for(int j = 0; i + j < n; j ++)
+      data[i + j] = buffer[j];
+  }
+}
+
+// exp(x - largest) / sum, the differences are at most 0 so only the lower limit is needed
+void Softmax(V::real *data, int n)
+{
+  V::real largest = data[0];
+  for(int i = 1; i < n; i ++)
+    largest = max(largest, data[i]);
+
+  V::type m = V::Set(largest), total = V::Zero();
+
+  int i = 0;
+  for(; i + V::width <= n; i += V::width) {
+    V::type e = Exp(V::Max(V::Sub(V::Load(data + i), m), V::Set(-Limit)));
+    V::Store(data + i, e);
+    total = V::Add(total, e);
+  }
+
+  V::real sum = V::Sum(total);
+  if(i < n) {
+    V::real buffer[V::width];
+    for(int j = 0; j < V::width; j ++)
+      buffer[j] = i + j < n ? data[i + j] - largest : -Limit;
+
+    V::Store(buffer, Exp(V::Max(V::Load(buffer), V::Set(-Limit))));
+
+    for(int j = 0; i + j < n; j ++) {
+      data[i + j] = buffer[j];
+      sum += buffer[j];
+    }
+  }
+
+  V::type inverse = V::Set(1 / sum);
+  for(i = 0; i + V::width <= n; i += V::width)
+    V::Store(data + i, V::Mul(V::Load(data + i), inverse));
+  for(; i < n; i ++)
+    data[i] /= sum;
+}
+
+// the steps of the optimizers, see Optimizer
+// the gradients are multiplied by scale before they are used
+
+// velocity = momentum * velocity + gradient, params -= rate * velocity
+void MomentumStep(V::real *params, const V::real *gradients, V::real *velocity, int n,
+                  V::real rate, V::real scale, V::real momentum)
+{
+  V::type r = V::Set(-rate), s = V::Set(scale), m = V::Set(momentum);
+
+  int i = 0;
+  for(; i + V::width <= n; i += V::width) {
+    V::type v = V::MulAdd(m, V::Load(velocity + i), V::Mul(s, V::Load(gradients + i)));
+    V::Store(velocity + i, v);
+    V::Store(params + i, V::MulAdd(r, v, V::Load(params + i)));
+  }
+
+  for(; i < n; i ++) {
+    velocity[i] = momentum * velocity[i] + scale * gradients[i];
+    params[i] -= rate * velocity[i];
+  }
+}
+
+// squares = decay * squares + (1 - decay) * gradient^2
+// params -= rate * gradient / (sqrt(squares) + epsilon)
+void RMSPropStep(V::real *params, const V::real *gradients, V::real *squares, int n,
+                 V::real rate, V::real scale, V::real decay, V::real epsilon)
+{
+  V::type r = V::Set(-rate), s = V::Set(scale), d = V::Set(decay), d1 = V::Set(1 - decay), e = V::Set(epsilon);
+
+  int i = 0;
+  for(; i + V::width <= n; i += V::width) {
+    V::type g = V::Mul(s, V::Load(gradients + i));
+    V::type q = V::MulAdd(d, V::Load(squares + i), V::Mul(d1, V::Mul(g, g)));
+    V::Store(squares + i, q);
+    V::Store(params + i, V::MulAdd(r, V::Div(g, V::Add(V::Sqrt(q), e)), V::Load(params + i)));
+  }
+
+  for(; i < n; i ++) {
+    V::real g = scale * gradients[i];
+    squares[i] = decay * squares[i] + (1 - decay) * g * g;
+    params[i] -= rate * g / ((V::real)sqrt(squares[i]) + epsilon);
+  }
+}
+
+// moments = beta1 * moments + (1 - beta1) * gradient
+// squares = beta2 * squares + (1 - beta2) * gradient^2
+// params -= rate * moments / (sqrt(squares) + epsilon)
+// the bias correction of Adam is left to the caller, it only changes the rate
+void AdamStep(V::real *params, const V::real *gradients, V::real *moments, V::real *squares, int n,
+              V::real rate, V::real scale, V::real beta1, V::real beta2, V::real epsilon)
+{
+  V::type r = V::Set(-rate), s = V::Set(scale), e = V::Set(epsilon);
+  V::type b1 = V::Set(beta1), c1 = V::Set(1 - beta1), b2 = V::Set(beta2), c2 = V::Set(1 - beta2);
+
+  int i = 0;
+  for(; i + V::width <= n; i += V::width) {
+    V::type g = V::Mul(s, V::Load(gradients + i));
+    V::type m = V::MulAdd(b1, V::Load(moments + i), V::Mul(c1, g));
+    V::type q = V::MulAdd(b2, V::Load(squares + i), V::Mul(c2, V::Mul(g, g)));
+    V::Store(moments + i, m);
+    V::Store(squares + i, q);
+    V::Store(params + i, V::MulAdd(r, V::Div(m, V::Add(V::Sqrt(q), e)), V::Load(params + i)));
+  }
+
+  for(; i < n; i ++) {
+    V::real g = scale * gradients[i];
+    moments[i] = beta1 * moments[i] + (1 - beta1) * g;
+    squares[i] = beta2 * squares[i] + (1 - beta2) * g * g;
+    params[i] -= rate * moments[i] / ((V::real)sqrt(squares[i]) + epsilon);
+  }
+}
@@ -0,0 +1,127 @@
+// AVX2 versions of the kernels, see Kernels.h
+#include <math.h>
+#include "Kernels.h"
+
+#ifdef KERNELS_X86
+
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC target("avx2,fma")
+#endif
+
+namespace AVX2Kernels
+{
+  struct V
+  {
+    typedef double real;
+    typedef __m256d type;
+    enum { width = 4 };
+
+    static inline type Zero() { return _mm256_setzero_pd(); }
+    static inline type Load(const double *p) { return _mm256_loadu_pd(p); }
+    static inline type Set(double x) { return _mm256_set1_pd(x); }
+    static inline void Store(double *p, type a) { _mm256_storeu_pd(p, a); }
+    static inline type Sub(type a, type b) { return _mm256_sub_pd(a, b); }
+    static inline type Mul(type a, type b) { return _mm256_mul_pd(a, b); }
+    static inline type Div(type a, type b) { return _mm256_div_pd(a, b); }
+    static inline type Min(type a, type b) { return _mm256_min_pd(a, b); }
+    static inline type Max(type a, type b) { return _mm256_max_pd(a, b); }
+    static inline type Sqrt(type a) { return _mm256_sqrt_pd(a); }
+    static inline type Step(type a) { return _mm256_and_pd(_mm256_cmp_pd(a, Zero(), _CMP_GT_OQ), Set(1.0)); }
+
+    static inline type Pow2(type t)
+    {
+      __m256i bits = _mm256_slli_epi64(_mm256_castpd_si256(t), 52);
+      return _mm256_castsi256_pd(_mm256_add_epi64(bits, _mm256_castpd_si256(Set(1.0))));
+    }
+
+    static inline type Add(type a, type b) { return _mm256_add_pd(a, b); }
+    static inline type MulAdd(type a, type b, type c) { return _mm256_fmadd_pd(a, b, c); }
+
+    static inline double Sum(type a)
+    {
+      __m128d s = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+      return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+  };
+
+  #include "Kernels.inl"
+
+  // the bytes are sign extended to 16 bits, multiplied and summed in pairs to 32 bits
+  int QuantizedDot(const signed char *a, const signed char *b, int n)
+  {
+    __m256i sum = _mm256_setzero_si256();
+
+    int i = 0;
+    for(; i + 16 <= n; i += 16) {
+      __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(a + i)));
+      __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(b + i)));
+      sum = _mm256_add_epi32(sum, _mm256_madd_epi16(va, vb));
+    }
+
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+
+    int total = _mm_cvtsi128_si32(s);
+    for(; i < n; i ++)
+      total += a[i] * b[i];
+    return total;
+  }
+}
+
+namespace AVX2FloatKernels
+{
+  struct V
+  {
+    typedef float real;
+    typedef __m256 type;
+    enum { width = 8 };
+
+    static inline type Zero() { return _mm256_setzero_ps(); }
+    static inline type Load(const float *p) { return _mm256_loadu_ps(p); }
+    static inline type Set(float x) { return _mm256_set1_ps(x); }
+    static inline void Store(float *p, type a) { _mm256_storeu_ps(p, a); }
+    static inline type Sub(type a, type b) { return _mm256_sub_ps(a, b); }
+    static inline type Mul(type a, type b) { return _mm256_mul_ps(a, b); }
+    static inline type Div(type a, type b) { return _mm256_div_ps(a, b); }
+    static inline type Min(type a, type b) { return _mm256_min_ps(a, b); }
+    static inline type Max(type a, type b) { return _mm256_max_ps(a, b); }
+    static inline type Sqrt(type a) { return _mm256_sqrt_ps(a); }
+    static inline type Step(type a) { return _mm256_and_ps(_mm256_cmp_ps(a, Zero(), _CMP_GT_OQ), Set(1.0f)); }
+
+    static inline type Pow2(type t)
+    {
+      __m256i bits = _mm256_slli_epi32(_mm256_castps_si256(t), 23);
+      return _mm256_castsi256_ps(_mm256_add_epi32(bits, _mm256_castps_si256(Set(1.0f))));
+    }
+
+    static inline type Add(type a, type b) { return _mm256_add_ps(a, b); }
+    static inline type MulAdd(type a, type b, type c) { return _mm256_fmadd_ps(a, b, c); }
+
+    static inline float Sum(type a)
+    {
+      __m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+      s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+      return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+    }
+  };
+
+  #include "Kernels.inl"
+}
+
+void Kernels::UseAVX2()
+{
+  USE_KERNELS(Double, AVX2Kernels);
+  USE_KERNELS(Float, AVX2FloatKernels);
+  QuantizedDot = AVX2Kernels::QuantizedDot;
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+
+#endif // KERNELS_X86
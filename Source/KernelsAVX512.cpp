@@ -0,0 +1,112 @@
+// AVX-512 versions of the kernels, see Kernels.h
+#include <math.h>
+#include "Kernels.h"
+
+#ifdef KERNELS_X86
+
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx512f"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC target("avx512f")
+#endif
+
+namespace AVX512Kernels
+{
+  struct V
+  {
+    typedef double real;
+    typedef __m512d type;
+    enum { width = 8 };
+
+    static inline type Zero() { return _mm512_setzero_pd(); }
+    static inline type Load(const double *p) { return _mm512_loadu_pd(p); }
+    static inline type Set(double x) { return _mm512_set1_pd(x); }
+    static inline void Store(double *p, type a) { _mm512_storeu_pd(p, a); }
+    static inline type Sub(type a, type b) { return _mm512_sub_pd(a, b); }
+    static inline type Mul(type a, type b) { return _mm512_mul_pd(a, b); }
+    static inline type Div(type a, type b) { return _mm512_div_pd(a, b); }
+    static inline type Min(type a, type b) { return _mm512_min_pd(a, b); }
+    static inline type Max(type a, type b) { return _mm512_max_pd(a, b); }
+    static inline type Sqrt(type a) { return _mm512_sqrt_pd(a); }
+    static inline type Step(type a) { return _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(a, Zero(), _CMP_GT_OQ), Set(1.0)); }
+
+    static inline type Pow2(type t)
+    {
+      __m512i bits = _mm512_slli_epi64(_mm512_castpd_si512(t), 52);
+      return _mm512_castsi512_pd(_mm512_add_epi64(bits, _mm512_castpd_si512(Set(1.0))));
+    }
+
+    static inline type Add(type a, type b) { return _mm512_add_pd(a, b); }
+    static inline type MulAdd(type a, type b, type c) { return _mm512_fmadd_pd(a, b, c); }
+    static inline double Sum(type a) { return _mm512_reduce_add_pd(a); }
+  };
+
+  #include "Kernels.inl"
+
+  // the bytes are sign extended to 32 bits, AVX-512F has no 8 or 16 bit arithmetic
+  int QuantizedDot(const signed char *a, const signed char *b, int n)
+  {
+    __m512i sum = _mm512_setzero_si512();
+
+    int i = 0;
+    for(; i + 16 <= n; i += 16) {
+      __m512i va = _mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i *)(a + i)));
+      __m512i vb = _mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i *)(b + i)));
+      sum = _mm512_add_epi32(sum, _mm512_mullo_epi32(va, vb));
+    }
+
+    int total = _mm512_reduce_add_epi32(sum);
+    for(; i < n; i ++)
+      total += a[i] * b[i];
+    return total;
+  }
+}
+
+namespace AVX512FloatKernels
+{
+  struct V
+  {
+    typedef float real;
+    typedef __m512 type;
+    enum { width = 16 };
+
+    static inline type Zero() { return _mm512_setzero_ps(); }
+    static inline type Load(const float *p) { return _mm512_loadu_ps(p); }
+    static inline type Set(float x) { return _mm512_set1_ps(x); }
+    static inline void Store(float *p, type a) { _mm512_storeu_ps(p, a); }
+    static inline type Sub(type a, type b) { return _mm512_sub_ps(a, b); }
+    static inline type Mul(type a, type b) { return _mm512_mul_ps(a, b); }
+    static inline type Div(type a, type b) { return _mm512_div_ps(a, b); }
+    static inline type Min(type a, type b) { return _mm512_min_ps(a, b); }
+    static inline type Max(type a, type b) { return _mm512_max_ps(a, b); }
+    static inline type Sqrt(type a) { return _mm512_sqrt_ps(a); }
+    static inline type Step(type a) { return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(a, Zero(), _CMP_GT_OQ), Set(1.0f)); }
+
+    static inline type Pow2(type t)
+    {
+      __m512i bits = _mm512_slli_epi32(_mm512_castps_si512(t), 23);
+      return _mm512_castsi512_ps(_mm512_add_epi32(bits, _mm512_castps_si512(Set(1.0f))));
+    }
+
+    static inline type Add(type a, type b) { return _mm512_add_ps(a, b); }
+    static inline type MulAdd(type a, type b, type c) { return _mm512_fmadd_ps(a, b, c); }
+    static inline float Sum(type a) { return _mm512_reduce_add_ps(a); }
+  };
+
+  #include "Kernels.inl"
+}
+
+void Kernels::UseAVX512()
+{
+  USE_KERNELS(Double, AVX512Kernels);
+  USE_KERNELS(Float, AVX512FloatKernels);
+  QuantizedDot = AVX512Kernels::QuantizedDot;
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+
+#endif // KERNELS_X86
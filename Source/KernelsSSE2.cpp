@@ -0,0 +1,128 @@
+// SSE2 versions of the kernels, see Kernels.h
+#include <math.h>
+#include "Kernels.h"
+
+#ifdef KERNELS_X86
+
+#include <emmintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("sse2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC target("sse2")
+#endif
+
+namespace SSE2Kernels
+{
+  struct V
+  {
+    typedef double real;
+    typedef __m128d type;
+    enum { width = 2 };
+
+    static inline type Zero() { return _mm_setzero_pd(); }
+    static inline type Load(const double *p) { return _mm_loadu_pd(p); }
+    static inline type Set(double x) { return _mm_set1_pd(x); }
+    static inline void Store(double *p, type a) { _mm_storeu_pd(p, a); }
+    static inline type Sub(type a, type b) { return _mm_sub_pd(a, b); }
+    static inline type Mul(type a, type b) { return _mm_mul_pd(a, b); }
+    static inline type Div(type a, type b) { return _mm_div_pd(a, b); }
+    static inline type Min(type a, type b) { return _mm_min_pd(a, b); }
+    static inline type Max(type a, type b) { return _mm_max_pd(a, b); }
+    static inline type Sqrt(type a) { return _mm_sqrt_pd(a); }
+    static inline type Step(type a) { return _mm_and_pd(_mm_cmpgt_pd(a, Zero()), Set(1.0)); }
+
+    static inline type Pow2(type t)
+    {
+      __m128i bits = _mm_slli_epi64(_mm_castpd_si128(t), 52);
+      return _mm_castsi128_pd(_mm_add_epi64(bits, _mm_castpd_si128(Set(1.0))));
+    }
+
+    static inline type Add(type a, type b) { return _mm_add_pd(a, b); }
+    static inline type MulAdd(type a, type b, type c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+    static inline double Sum(type a) { return _mm_cvtsd_f64(_mm_add_sd(a, _mm_unpackhi_pd(a, a))); }
+  };
+
+  #include "Kernels.inl"
+
+  // the bytes are sign extended to 16 bits, multiplied and summed in pairs to 32 bits
+  int QuantizedDot(const signed char *a, const signed char *b, int n)
+  {
+    __m128i sum = _mm_setzero_si128();
+
+    int i = 0;
+    for(; i + 16 <= n; i += 16) {
+      __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+      __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+
+      // a byte unpacked next to itself and shifted right by 8 is sign extended
+      __m128i alow = _mm_srai_epi16(_mm_unpacklo_epi8(va, va), 8);
+      __m128i ahigh = _mm_srai_epi16(_mm_unpackhi_epi8(va, va), 8);
+      __m128i blow = _mm_srai_epi16(_mm_unpacklo_epi8(vb, vb), 8);
+      __m128i bhigh = _mm_srai_epi16(_mm_unpackhi_epi8(vb, vb), 8);
+
+      sum = _mm_add_epi32(sum, _mm_madd_epi16(alow, blow));
+      sum = _mm_add_epi32(sum, _mm_madd_epi16(ahigh, bhigh));
+    }
+
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+
+    int total = _mm_cvtsi128_si32(sum);
+    for(; i < n; i ++)
+      total += a[i] * b[i];
+    return total;
+  }
+}
+
+namespace SSE2FloatKernels
+{
+  struct V
+  {
+    typedef float real;
+    typedef __m128 type;
+    enum { width = 4 };
+
+    static inline type Zero() { return _mm_setzero_ps(); }
+    static inline type Load(const float *p) { return _mm_loadu_ps(p); }
+    static inline type Set(float x) { return _mm_set1_ps(x); }
+    static inline void Store(float *p, type a) { _mm_storeu_ps(p, a); }
+    static inline type Sub(type a, type b) { return _mm_sub_ps(a, b); }
+    static inline type Mul(type a, type b) { return _mm_mul_ps(a, b); }
+    static inline type Div(type a, type b) { return _mm_div_ps(a, b); }
+    static inline type Min(type a, type b) { return _mm_min_ps(a, b); }
+    static inline type Max(type a, type b) { return _mm_max_ps(a, b); }
+    static inline type Sqrt(type a) { return _mm_sqrt_ps(a); }
+    static inline type Step(type a) { return _mm_and_ps(_mm_cmpgt_ps(a, Zero()), Set(1.0f)); }
+
+    static inline type Pow2(type t)
+    {
+      __m128i bits = _mm_slli_epi32(_mm_castps_si128(t), 23);
+      return _mm_castsi128_ps(_mm_add_epi32(bits, _mm_castps_si128(Set(1.0f))));
+    }
+
+    static inline type Add(type a, type b) { return _mm_add_ps(a, b); }
+    static inline type MulAdd(type a, type b, type c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+
+    static inline float Sum(type a)
+    {
+      __m128 s = _mm_add_ps(a, _mm_movehl_ps(a, a));
+      return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+    }
+  };
+
+  #include "Kernels.inl"
+}
+
+void Kernels::UseSSE2()
+{
+  USE_KERNELS(Double, SSE2Kernels);
+  USE_KERNELS(Float, SSE2FloatKernels);
+  QuantizedDot = SSE2Kernels::QuantizedDot;
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+
+#endif // KERNELS_X86
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 #include "GANet.h"
@@ -24,8 +25,8 @@ void add(double *input, double *output)
 LayeredNet* CreateNet()
 {
   LayeredNet *net = new LayeredNet(2, 1);
-  net->AddLayer(new Layer(3));
-  // net.AddLayer(new Layer(2)); // can add another layer if we want to
+  net->AddLayer(3);
+  // net.AddLayer(2); // can add another layer if we want to
   net->ConnectGroups(); // connect all the layers together
 
   // create additional connections between the input and output layers
@@ -84,8 +85,8 @@ void test() {
   for(int i = 0; i < count; i ++) {
     nets[i] = new LayeredNet(INPUT_COUNT, OUTPUT_COUNT);
     
-    nets[i]->AddLayer(new Layer(3));
-    // net.AddLayer(new Layer(2)); // can add another layer if we want to
+    nets[i]->AddLayer(3);
+    // net.AddLayer(2); // can add another layer if we want to
     nets[i]->ConnectGroups(); // connect all the layers together
 
     // create additional connections between the input and output layers
@@ -110,6 +111,9 @@ void test() {
   delete[] nets;
 }
 
+// runs the regression checks, see Tests.cpp
+bool runchecks();
+
 void testserialize(LayeredNet *net) 
 {
   FILE *out = fopen("test.net", "wb");
@@ -121,8 +125,15 @@ void testserialize(LayeredNet *net)
   fclose(in);
 }
 
-void main()
+// started with -check it only runs the regression checks
+void main(int argc, char *argv[])
 {
+  if(argc > 1 && strcmp(argv[1], "-check") == 0) {
+    if(!runchecks())
+      printf("Some checks failed!\n");
+    return;
+  }
+
   // get a trainer
   GATrainer *trainer = trainadd();
   printf("Training completed!\n");
@@ -146,8 +157,7 @@ void main()
     if(net->Update(in, out)) {
       printf("=%g\n", out[0]);
     } else
-      printf( "Update failed: there's something wrong with the structure of the neural net\n"
-              "               check for loops and neurons without inputs\n");
+      printf("Update failed: %s\n", net->GetSchedule()->GetErrorMessage());
   }
 
   // remove all the nets weve created
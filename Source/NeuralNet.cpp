@@ -1,7 +1,122 @@
 #include <math.h>
 #include <stdlib.h>
 #include <float.h>
+#include <string.h>
 #include "NeuralNet.h"
+#include "CompiledNet.h"
+#include "Dataset.h"
+
+Mutex Arena::versionmutex;
+int Arena::lastversion = 0;
+
+Arena::Arena() : blocks(null), top(null), left(0), blocksize(MinBlockSize), freelistcount(0),
+  shared(false), discarding(false), topologyversion(0)
+{
+  TopologyChanged();
+}
+
+Arena::~Arena()
+{
+  Free();
+}
+
+void* Arena::Allocate(int size)
+{
+  size = (size + 7) & ~7;
+
+  for(int i = 0; i < freelistcount; i ++) {
+    FreeList &list = freelists[i];
+    if(list.size == size && list.objects != null) {
+      void *memory = list.objects;
+      list.objects = *(void **)memory;
+      return memory;
+    }
+  }
+
+  if(size > left) {
+    int newsize = max(blocksize, size + (int)sizeof(Block));
+    if(blocksize < MaxBlockSize) blocksize *= 2;
+
+    Block *block = (Block *)malloc(newsize);
+    block->size = newsize;
+    block->next = blocks;
+    blocks = block;
+
+    top = (char *)block + sizeof(Block);
+    left = newsize - sizeof(Block);
+  }
+
+  void *memory = top;
+  top += size;
+  left -= size;
+  return memory;
+}
+
+void Arena::Recycle(void *object, int size)
+{
+  size = (size + 7) & ~7;
+
+  int i = 0;
+  while(i < freelistcount && freelists[i].size != size) i ++;
+
+  if(i == freelistcount) {
+    // there are only a few sizes of neurons and synapses, the memory of any others stays unused
+    if(freelistcount == sizeof(freelists) / sizeof(freelists[0])) return;
+    freelists[i].size = size;
+    freelists[i].objects = null;
+    freelistcount ++;
+  }
+
+  *(void **)object = freelists[i].objects;
+  freelists[i].objects = object;
+}
+
+void Arena::Free()
+{
+  while(blocks != null) {
+    Block *next = blocks->next;
+    free(blocks);
+    blocks = next;
+  }
+
+  top = null;
+  left = 0;
+  blocksize = MinBlockSize;
+  freelistcount = 0;
+  shared = false;
+}
+
+void Arena::TopologyChanged()
+{
+  versionmutex.Lock();
+  topologyversion = ++ lastversion;
+  versionmutex.Unlock();
+}
+
+void* Arena::New(size_t size, Arena *arena)
+{
+  char *memory;
+  if(arena != null)
+    memory = (char *)arena->Allocate((int)size + HeaderSize);
+  else
+    memory = (char *)malloc(size + HeaderSize);
+
+  *(Arena **)memory = arena;
+  return memory + HeaderSize;
+}
+
+void Arena::Delete(void *object, size_t size)
+{
+  if(object == null) return;
+
+  char *memory = (char *)object - HeaderSize;
+  Arena *arena = *(Arena **)memory;
+  if(arena == null)
+    free(memory);
+  else if(size > 0)
+    arena->Recycle(memory, (int)size + HeaderSize);
+}
+
 
 double Synapse::GetConnectedData()
 {
@@ -19,6 +134,7 @@ Synapse::Synapse() : neuron(null), synapse(null)
 
 Synapse::~Synapse() 
 {
+  if(neuron != null) neuron->ConnectionsChanged();
   if(synapse != null) {
     synapse->synapse = null;
     delete synapse;
@@ -35,7 +151,7 @@ double InputSynapse::GetWeight()
   return weight;
 }
 
-InputSynapse::InputSynapse() : weight(0.0), temp(0.0)
+InputSynapse::InputSynapse() : weight(0.0)
 {
 }
 
@@ -52,6 +168,8 @@ Neuron* Bias::GetConnectedNeuron()
 const double Neuron::NoData = DBL_MIN;
 const double Neuron::ThisNeuron = DBL_MAX;
 
+int Neuron::topologyversion = 0;
+
 double Neuron::LinearTransfer(double input)
 {
   return input;
@@ -68,6 +186,25 @@ double Neuron::SigmoidTransfer(double input)
   return 1.0/(1.0 + exp(-input / p));
 }
 
+double Neuron::TanhTransfer(double input)
+{
+  return tanh(input);
+}
+
+double Neuron::ReluTransfer(double input)
+{
+  return input > 0.0 ? input : 0.0;
+}
+
+double Neuron::GetDerivative(TRANSFERFUNCTION transfer, double output)
+{
+  if(transfer == LinearTransfer) return 1.0;
+  if(transfer == StepTransfer) return 0.0;
+  if(transfer == TanhTransfer) return 1.0 - output * output;
+  if(transfer == ReluTransfer) return output > 0.0 ? 1.0 : 0.0;
+  return output * (1.0 - output);
+}
+
 double Neuron::ZeroWeights()
 {
   return 0;
@@ -86,13 +223,10 @@ double Neuron::RandomWeights()
 
 void Neuron::SetWeights(WEIGHTFUNCTION weight)
 {
-  if(weight != null) {
-    forEach(InputSynapse, inputs, connector)
-      connector->weight = weight();
-  } else {
-    forEach(InputSynapse, inputs, connector)
-      connector->weight = connector->temp;
-  }
+  if(weight == null) return;
+
+  forEach(InputSynapse, inputs, connector)
+    connector->weight = weight();
 }
 
 void Neuron::AddInput(Neuron *neuron, double weight)
@@ -102,11 +236,20 @@ void Neuron::AddInput(Neuron *neuron, double weight)
 
 void Neuron::AddOutput(Neuron *neuron, double weight)
 {
-  OutputSynapse *output = new OutputSynapse();
+  // both synapses come from the arena the neurons are in, one after the other
+  // connections between arenas are allocated from the heap and mark the arenas as shared
+  Arena *arena = GetArena();
+  if(neuron->GetArena() != arena) {
+    if(arena != null) arena->SetShared();
+    if(neuron->GetArena() != null) neuron->GetArena()->SetShared();
+    arena = null;
+  }
+
+  OutputSynapse *output = new(arena) OutputSynapse();
   output->neuron = this;
   outputs.Attach(output);
 
-  InputSynapse *input = new InputSynapse();
+  InputSynapse *input = new(arena) InputSynapse();
   input->neuron = neuron;
   neuron->inputs.Attach(input);
 
@@ -114,25 +257,23 @@ void Neuron::AddOutput(Neuron *neuron, double weight)
 
   output->synapse = input;
   input->synapse = output;
+
+  ConnectionsChanged();
+  neuron->ConnectionsChanged();
+}
+
+void Neuron::ConnectionsChanged()
+{
+  if(arena != null) arena->TopologyChanged();
+  else topologyversion ++;
 }
 
 double Neuron::Update()
 {
   double sum = 0.0;
 
-  data = ThisNeuron;
-
-  forEach(InputSynapse, inputs, input) {
-    double inputdata = input->GetConnectedData();
-
-    if(inputdata == NoData)
-      inputdata = input->GetConnectedNeuron()->Update();
-    // check for errors: loops
-    else if(inputdata == ThisNeuron) 
-      return 0.0;
-    
-    sum += inputdata * input->weight;
-  }
+  forEach(InputSynapse, inputs, input)
+    sum += input->GetConnectedData() * input->weight;
 
   // printf("Neuron::Update: %d-%d\n", inputs.GetSize(), outputs.GetSize());
   data = TransferFunction(sum);
@@ -143,7 +284,7 @@ void Neuron::SetBias(double b)
 {
   if(bias != null) bias->weight = b;
   else {
-    bias = new Bias();
+    bias = new(GetArena()) Bias();
     bias->weight = b;
     inputs.Attach(bias);
   }
@@ -155,30 +296,63 @@ double Neuron::GetBias()
   return 0.0;
 }
 
-Neuron::Neuron() : TransferFunction(null), bias(null), data(NoData)
+Neuron::Neuron() : TransferFunction(null), bias(null), data(NoData), arena(null), mark(0)
 {
 }
 
-Neuron::Neuron(double d) : TransferFunction(null), bias(null), data(d)
+Neuron::Neuron(double d) : TransferFunction(null), bias(null), data(d), arena(null), mark(0)
 {
 }
 
-Neuron::Neuron(double d, double b) : TransferFunction(null), data(d)
+Neuron::Neuron(double d, double b) : TransferFunction(null), data(d), arena(null), mark(0)
 {
   bias = new Bias();
   bias->weight = b;
   inputs.Attach(bias);
 }
 
-bool Group::Update()
+Neuron::Neuron(Arena *a, double d, double b) : data(d), TransferFunction(null), arena(a), mark(0)
 {
-  bool ret = true;
-  ::Container *outputs = GetOutputs();
-  forEach(Neuron, (*outputs), output) {
-    double data = output->Update();
-    if(data == 0.0) ret = false;
+  bias = new(GetArena()) Bias();
+  bias->weight = b;
+  inputs.Attach(bias);
+}
+
+Group::Group() : schedule(null), scheduleversion(-1)
+{
+}
+
+Group::~Group()
+{
+  safe_delete(schedule);
+}
+
+int Group::GetTopologyVersion()
+{
+  return Neuron::GetTopologyVersion();
+}
+
+bool Group::BuildSchedule()
+{
+  if(schedule == null) schedule = new Schedule();
+
+  if(!schedule->Build(this)) {
+    scheduleversion = -1;
+    return false;
   }
-  return ret;
+
+  scheduleversion = GetTopologyVersion();
+  return true;
+}
+
+bool Group::Update()
+{
+  // the schedule is kept until the structure of the group changes
+  if(scheduleversion != GetTopologyVersion() && !BuildSchedule())
+    return false;
+
+  schedule->Update();
+  return true;
 }
 
 void Group::Connect(Group *group)
@@ -212,12 +386,192 @@ void Group::Connect(Neuron *neuron)
 
 
 
-Container* Layer::GetInputs()
+unsigned int Schedule::laststamp = 0;
+Mutex Schedule::stampmutex;
+
+Schedule::Schedule() : neurons(null), count(0), stack(null), stackinputs(null), stacksize(0),
+  capacity(0), stackcapacity(0), error(NoError), errorneuron(null), stamp(0)
+{
+  message[0] = 0;
+}
+
+Schedule::~Schedule()
+{
+  safe_delete_array(neurons);
+  safe_delete_array(stack);
+  safe_delete_array(stackinputs);
+}
+
+void Schedule::Clear()
+{
+  count = stacksize = 0;
+  error = NoError;
+  errorneuron = null;
+  message[0] = 0;
+}
+
+void Schedule::Add(Neuron *neuron)
+{
+  if(count == capacity) {
+    capacity = max(64, capacity * 2);
+    Neuron **newneurons = new Neuron*[capacity];
+    if(count > 0) memcpy(newneurons, neurons, count * sizeof(Neuron *));
+    safe_delete_array(neurons);
+    neurons = newneurons;
+  }
+  neurons[count ++] = neuron;
+}
+
+void Schedule::Push(Neuron *neuron)
+{
+  if(stacksize == stackcapacity) {
+    stackcapacity = max(64, stackcapacity * 2);
+    Neuron **newstack = new Neuron*[stackcapacity];
+    InputSynapse **newstackinputs = new InputSynapse*[stackcapacity];
+    if(stacksize > 0) {
+      memcpy(newstack, stack, stacksize * sizeof(Neuron *));
+      memcpy(newstackinputs, stackinputs, stacksize * sizeof(InputSynapse *));
+    }
+    safe_delete_array(stack);
+    safe_delete_array(stackinputs);
+    stack = newstack;
+    stackinputs = newstackinputs;
+  }
+
+  // the mark is stamp while the neuron is on the stack, stamp + 1 once it has been scheduled
+  neuron->mark = stamp;
+
+  stack[stacksize] = neuron;
+  stackinputs[stacksize] = (InputSynapse *)neuron->inputs.Elements();
+  stacksize ++;
+}
+
+void Schedule::Describe(Neuron *neuron, ::Container *groups)
+{
+  char description[64];
+  description[0] = 0;
+
+  if(groups != null) {
+    int g = 0;
+    forEach(Group, (*groups), group) {
+      int index = group->GetOutputs()->GetIndex(neuron);
+      if(index == -1) index = group->GetInputs()->GetIndex(neuron);
+      if(index != -1) {
+        sprintf(description, "neuron %d in group %d", index, g);
+        break;
+      }
+      g ++;
+    }
+  }
+
+  if(description[0] == 0)
+    sprintf(description, "neuron %p", (void *)neuron);
+
+  int length = (int)strlen(message);
+  strncat(message, description, sizeof(message) - length - 1);
+}
+
+void Schedule::SetError(int e, Neuron *neuron, ::Container *groups)
+{
+  error = e;
+  errorneuron = neuron;
+
+  if(error == NoInputs) {
+    strcpy(message, "no inputs: ");
+    Describe(neuron, groups);
+  } else {
+    // the loop is made up of the neurons on the stack, starting with neuron
+    strcpy(message, "loop: ");
+    int first = stacksize - 1;
+    while(first > 0 && stack[first] != neuron) first --;
+
+    for(int i = first; i < stacksize; i ++) {
+      Describe(stack[i], groups);
+      strncat(message, " <- ", sizeof(message) - strlen(message) - 1);
+    }
+    Describe(neuron, groups);
+  }
+}
+
+bool Schedule::Build(Group *group, ::Container *groups)
+{
+  Clear();
+
+  // a new stamp tells the neurons visited by this build apart from all the others
+  // each build takes 2 values, see Push
+  stampmutex.Lock();
+  laststamp += 2;
+  stamp = laststamp;
+  stampmutex.Unlock();
+
+  forEach(Neuron, (*group->GetInputs()), input)
+    input->mark = stamp + 1;
+
+  // depth first search starting from each output neuron, a neuron is added to
+  // the schedule once all the neurons it depends on have been added
+  forEach(Neuron, (*group->GetOutputs()), output) {
+    if(output->mark == stamp + 1) continue;
+    Push(output);
+
+    while(stacksize > 0) {
+      Neuron *neuron = stack[stacksize - 1];
+      InputSynapse *input = stackinputs[stacksize - 1];
+
+      // skip the bias
+      while(input != null && input->GetConnectedNeuron() == null)
+        input = (InputSynapse *)input->Next();
+
+      if(input == null) {
+        // all the inputs have been scheduled, check that there was at least one
+        bool connected = false;
+        forEach(InputSynapse, neuron->inputs, i) {
+          if(i->GetConnectedNeuron() != null) {
+            connected = true;
+            break;
+          }
+        }
+
+        if(!connected) {
+          SetError(NoInputs, neuron, groups);
+          count = stacksize = 0;
+          return false;
+        }
+
+        neuron->mark = stamp + 1;
+        Add(neuron);
+        stacksize --;
+        continue;
+      }
+
+      stackinputs[stacksize - 1] = (InputSynapse *)input->Next();
+
+      Neuron *source = input->GetConnectedNeuron();
+      if(source->mark != stamp && source->mark != stamp + 1) {
+        Push(source);
+      } else if(source->mark == stamp) {
+        SetError(Loop, source, groups);
+        count = stacksize = 0;
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+void Schedule::Update()
+{
+  for(int i = 0; i < count; i ++)
+    neurons[i]->Update();
+}
+
+
+IndexedContainer* Layer::GetInputs()
 {
   return &neurons;
 }
   
-Container* Layer::GetOutputs()
+IndexedContainer* Layer::GetOutputs()
 {
   return &neurons;
 }
@@ -230,19 +584,50 @@ void Layer::SetWeights(WEIGHTFUNCTION weight)
 
 void Layer::SetTransferFunctions(TRANSFERFUNCTION transfer)
 {
+  if(softmax) return;
+
   forEach(Neuron, neurons, neuron)
     neuron->SetTransferFunction(transfer);
 }
 
-Layer::Layer(int size)
+bool Layer::SetSoftmax(bool s)
+{
+  // the output layer is the last group of a net, after the input layer
+  if(s && (Container() == null || Next() != null || Prev() == null))
+    return false;
+
+  softmax = false;
+  if(s) SetTransferFunctions(Neuron::LinearTransfer);
+  softmax = s;
+
+  // the compiled copies of the net have to pick up the change
+  if(arena != null) arena->TopologyChanged();
+  else Neuron::TopologyChanged();
+  return true;
+}
+
+Layer::Layer(int size, Arena *a) : arena(a), softmax(false)
 {
   for(int i = 0; i < size; i ++) {
     // add a neuron with bias
-    Neuron *neuron = new Neuron(0.0, 0.0);
+    Neuron *neuron = new(arena) Neuron(arena, 0.0, 0.0);
     neurons.Attach(neuron);
   }
 }
 
+int Layer::GetTopologyVersion()
+{
+  if(arena == null) return Neuron::GetTopologyVersion();
+  return arena->GetTopologyVersion() + Neuron::GetTopologyVersion();
+}
+
+Layer::~Layer()
+{
+  // the neurons are freed along with the arena
+  if(arena != null && arena->Discarding())
+    neurons.Abandon();
+}
+
 void Layer::Reset()
 {
   forEach(Neuron, neurons, neuron)
@@ -250,12 +635,12 @@ void Layer::Reset()
 }
 
 
-Container* NeuralNet::GetInputs()
+IndexedContainer* NeuralNet::GetInputs()
 {
   return &input->neurons;
 }
 
-Container* NeuralNet::GetOutputs()
+IndexedContainer* NeuralNet::GetOutputs()
 {
   return &output->neurons;
 }
@@ -263,6 +648,7 @@ Container* NeuralNet::GetOutputs()
 void NeuralNet::AddGroup(Group *group)
 {
   groups.AttachBefore(group, output);
+  arena.TopologyChanged();
   Group *inputgroup = (Group *)group->Prev();
 }
 
@@ -288,22 +674,99 @@ void NeuralNet::SetTransferFunctions(TRANSFERFUNCTION transfer)
     group->SetTransferFunctions(transfer);
 }
 
-bool NeuralNet::Update(double *inputbuffer, double *outputbuffer)
+bool NeuralNet::BuildSchedule()
+{
+  if(schedule == null) schedule = new Schedule();
+
+  if(!schedule->Build(this, &groups)) {
+    scheduleversion = -1;
+    return false;
+  }
+
+  scheduleversion = GetTopologyVersion();
+  return true;
+}
+
+int NeuralNet::GetTopologyVersion()
+{
+  return arena.GetTopologyVersion() + Neuron::GetTopologyVersion();
+}
+
+bool NeuralNet::Update(const double *inputbuffer, double *outputbuffer)
 {
-  Reset();
+  if(scheduleversion != GetTopologyVersion() && !BuildSchedule())
+    return false;
 
   int i = 0;
   forEach(Neuron, (input->neurons), in)
     in->Data() = inputbuffer[i ++];
 
-  if(output->Update()) {
-    int j = 0;
-    forEach(Neuron, (output->neurons), out)
-      outputbuffer[j ++] = out->Data();
-    return true;
+  schedule->Update();
+
+  int j = 0;
+  forEach(Neuron, (output->neurons), out)
+    outputbuffer[j ++] = out->Data();
+
+  if(output->IsSoftmax()) {
+    double largest = outputbuffer[0], sum = 0.0;
+    for(int i = 1; i < j; i ++)
+      largest = max(largest, outputbuffer[i]);
+    for(int i = 0; i < j; i ++)
+      sum += outputbuffer[i] = exp(outputbuffer[i] - largest);
+
+    j = 0;
+    forEach(Neuron, (output->neurons), out) {
+      outputbuffer[j] /= sum;
+      out->Data() = outputbuffer[j ++];
+    }
+  }
+  return true;
+}
+
+// compiles the net unless the compiled copy is up to date, in which case just the weights are reloaded
+// returns false if the net can't be compiled
+template<class real> static bool PrepareCompiled(NeuralNet *net, CompiledNetT<real> *compiled, int &version)
+{
+  if(version == net->GetTopologyVersion()) {
+    // a net that couldn't be compiled has no layers
+    if(compiled->GetLayerCount() == 0) return false;
+    if(compiled->Reload(net)) return true;
+  }
+
+  version = net->GetTopologyVersion();
+  return compiled->Compile(net);
+}
+
+bool NeuralNet::UpdateBatch(const double *inputs, int n, double *outputs)
+{
+  int inputcount = input->neurons.GetSize(), outputcount = output->neurons.GetSize();
+
+  if(precision == Float) {
+    if(floatcompiled == null) floatcompiled = new FloatCompiledNet();
+    if(PrepareCompiled(this, floatcompiled, floatversion)) {
+      size_t incount = (size_t)n * inputcount, outcount = (size_t)n * outputcount;
+      float *in = (float *)floatinputs.GetBuffer(incount * sizeof(float));
+      float *out = (float *)floatoutputs.GetBuffer(outcount * sizeof(float));
+      for(size_t i = 0; i < incount; i ++)
+        in[i] = (float)inputs[i];
+
+      bool ret = floatcompiled->UpdateBatch(in, n, out);
+      for(size_t i = 0; i < outcount; i ++)
+        outputs[i] = out[i];
+      return ret;
+    }
+  } else {
+    if(compiled == null) compiled = new CompiledNet();
+    if(PrepareCompiled(this, compiled, compiledversion))
+      return compiled->UpdateBatch(inputs, n, outputs);
   }
 
-  return false;
+  bool ret = true;
+  for(int i = 0; i < n; i ++) {
+    if(!Update((double *)inputs + (size_t)i * inputcount, outputs + (size_t)i * outputcount))
+      ret = false;
+  }
+  return ret;
 }
 
 void NeuralNet::Reset()
@@ -313,15 +776,39 @@ void NeuralNet::Reset()
 }
 
 
-NeuralNet::NeuralNet(int inputcount, int outputcount)
+NeuralNet::NeuralNet(int inputcount, int outputcount) : precision(Double),
+  compiled(null), floatcompiled(null), compiledversion(-1), floatversion(-1)
 {
-  input = new Layer(inputcount);
-  output = new Layer(outputcount);
+  input = new Layer(inputcount, &arena);
+  output = new Layer(outputcount, &arena);
 
   groups.Attach(input);
   groups.AttachLast(output);
 }
 
+NeuralNet::~NeuralNet()
+{
+  safe_delete(compiled);
+  safe_delete(floatcompiled);
+  DeleteGroups();
+}
+
+void NeuralNet::DeleteGroups()
+{
+  // unless they are connected to neurons outside of the arena, the layers forget their
+  // neurons instead of deleting them one connection at a time and the arena then
+  // frees them all at once
+  if(!arena.IsShared()) {
+    arena.Discarding() = true;
+    groups.Empty();
+    arena.Discarding() = false;
+    arena.Free();
+  } else
+    groups.Empty();
+
+  input = output = null;
+}
+
 Neuron* LayeredNet::GetNeuron(int groupindex, int neuronindex)
 {
   Layer *layer = (Layer *)groups.Get(groupindex);
@@ -343,6 +830,9 @@ bool LayeredNet::Save(FILE *file)
     i ++;
   }
 
+  int header[3] = { FileTag, FileVersion, precision };
+  fwrite(header, sizeof(int), 3, file);
+
   int groupssize = groups.GetSize();
   fwrite(&groupssize, sizeof(int), 1, file);
 
@@ -351,6 +841,9 @@ bool LayeredNet::Save(FILE *file)
     int layersize = layer->neurons.GetSize();
     fwrite(&layersize, sizeof(int), 1, file);
 
+    int flags = layer->IsSoftmax() ? SoftmaxLayer : 0;
+    fwrite(&flags, sizeof(int), 1, file);
+
     forEach(Neuron, layer->neurons, neuron) {
       int weightcount = neuron->inputs.GetSize();
       fwrite(&weightcount, sizeof(int), 1, file);
@@ -364,10 +857,14 @@ bool LayeredNet::Save(FILE *file)
         neuronindex = neuron == null ? -1 : thislayer->neurons.GetIndex(neuron);
         
         double weight = input->GetWeight();
+        float floatweight = (float)weight;
         
         fwrite(&groupindex, sizeof(int), 1, file);
         fwrite(&neuronindex, sizeof(int), 1, file);
-        fwrite(&weight, sizeof(double), 1, file);
+        if(precision == Float)
+          fwrite(&floatweight, sizeof(float), 1, file);
+        else
+          fwrite(&weight, sizeof(double), 1, file);
       }
     }
     i ++;
@@ -378,16 +875,34 @@ bool LayeredNet::Save(FILE *file)
 
 bool LayeredNet::Load(FILE *file)
 {
-  groups.Empty();
-  input = output = null;
-
   int groupssize;
   fread(&groupssize, sizeof(int), 1, file);
+
+  int fileprecision = Double, version = 0;
+  if(groupssize == FileTag) {
+    fread(&version, sizeof(int), 1, file);
+    fread(&fileprecision, sizeof(int), 1, file);
+    if(version > FileVersion || (fileprecision != Double && fileprecision != Float))
+      return false;
+    fread(&groupssize, sizeof(int), 1, file);
+  }
+
+  DeleteGroups();
+  precision = fileprecision;
+
+  // the layers that are softmax layers, their transfer functions are set at the end
+  bool softmax = false;
+
   for(int i = 0; i < groupssize; i ++) {
-    int layersize;
+    int layersize, flags = 0;
     fread(&layersize, sizeof(int), 1, file);
-    Layer *layer = new Layer(layersize);
+    if(version >= 2)
+      fread(&flags, sizeof(int), 1, file);
+
+    Layer *layer = new Layer(layersize, &arena);
     groups.AttachLast(layer);
+    if(flags & SoftmaxLayer)
+      softmax = true;
     for(int j = 0; j < layersize; j ++) {
       int weightcount;
       fread(&weightcount, sizeof(int), 1, file);
@@ -395,9 +910,15 @@ bool LayeredNet::Load(FILE *file)
       for(int k = 0; k < weightcount; k ++) {
         int groupindex, neuronindex;
         double weight;
+        float floatweight;
         fread(&groupindex, sizeof(int), 1, file);
         fread(&neuronindex, sizeof(int), 1, file);
-        fread(&weight, sizeof(double), 1, file);
+        if(precision == Float) {
+          fread(&floatweight, sizeof(float), 1, file);
+          weight = floatweight;
+        } else {
+          fread(&weight, sizeof(double), 1, file);
+        }
         
         if(groupindex == -1) {
           ((Neuron *)layer->neurons.Get(j))->SetBias(weight);
@@ -423,10 +944,15 @@ bool LayeredNet::Load(FILE *file)
   }
 
   SetTransferFunctions(Neuron::SigmoidTransfer);
+  if(softmax && output != null)
+    output->SetSoftmax(true);
+
+  arena.TopologyChanged();
   return true;
 }
 
-NetTrainer::NetTrainer(int in, int out) : inputcount(in), outputcount(out), input(null), train(null)
+NetTrainer::NetTrainer(int in, int out) : inputcount(in), outputcount(out), input(null), train(null),
+  dataset(null)
 {
   inputbuffer = new double[inputcount];
   outputbuffer1 = new double[outputcount];
@@ -442,3 +968,41 @@ NetTrainer::~NetTrainer()
 
 const double NetTrainer::TrainError = DBL_MAX;
 
+bool NetTrainer::SetDataset(Dataset *d)
+{
+  if(d != null && (d->GetInputCount() != inputcount || d->GetTargetCount() != outputcount))
+    return false;
+
+  dataset = d;
+  return true;
+}
+
+void NetTrainer::GetSample(int state, const double *&inputs, const double *&targets)
+{
+  GetSamples(&state, 1, inputbuffer, outputbuffer1, inputs, targets);
+}
+
+void NetTrainer::GetSamples(const int *states, int n, double *inputbuffer, double *targetbuffer,
+                            const double *&inputs, const double *&targets)
+{
+  if(dataset != null) {
+    int r = 1;
+    while(r < n && states[r] == states[0] + r)
+      r ++;
+
+    if(r == n && dataset->GetView(states[0], n, inputs, targets))
+      return;
+
+    dataset->GetBatch(states, n, inputbuffer, targetbuffer);
+  } else {
+    for(int r = 0; r < n; r ++) {
+      // generate the given state (the state parameter may be ignored by the network)
+      input(inputbuffer + (size_t)r * inputcount, states[r]);
+      train(inputbuffer + (size_t)r * inputcount, targetbuffer + (size_t)r * outputcount);
+    }
+  }
+
+  inputs = inputbuffer;
+  targets = targetbuffer;
+}
+
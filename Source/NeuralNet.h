@@ -4,6 +4,94 @@
 
 // info on neural nets is available at ftp://ftp.sas.com/pub/neural/FAQ.html
 
+// an arena allocates neurons and synapses from large contiguous blocks
+// so that the objects of a net, and a neuron's connections in particular,
+// end up close together in memory
+// deleting an object allocated in an arena puts its memory on a free list of the arena,
+// from which objects of the same size are allocated again, the blocks themselves
+// are freed all at once, either explicitly or when the arena is destroyed
+// an arena isn't thread safe, but several arenas may be used on different threads
+class Arena
+{
+protected:
+  // each block is followed by its data
+  struct Block
+  {
+    Block *next;
+    int size;
+  };
+
+  Block *blocks;
+  char *top;
+  int left;
+
+  // the size of the next block, the first one is small so that small nets don't
+  // waste memory, and each one is twice as large as the one before, up to MaxBlockSize
+  int blocksize;
+
+  // the deleted objects of each size, linked through their first bytes
+  struct FreeList
+  {
+    int size;
+    void *objects;
+  };
+
+  FreeList freelists[8];
+  int freelistcount;
+
+  bool shared;
+  bool discarding;
+
+  // see GetTopologyVersion, the versions of all the arenas come from one counter,
+  // so a net never shares its version with a net that was deleted before it
+  int topologyversion;
+  static int lastversion;
+  static Mutex versionmutex;
+
+  enum { MinBlockSize = 1 << 12, MaxBlockSize = 1 << 20 };
+
+  // New stores the arena of an object in front of the memory it returns, so that
+  // Delete finds it without searching, 8 bytes keep the objects aligned for doubles
+  // only New and Delete use it, the objects themselves don't know it's there
+  enum { HeaderSize = 8 };
+
+public:
+
+  // allocates size bytes from the arena
+  void* Allocate(int size);
+
+  // puts the memory of an object allocated from the arena on the free list of its size
+  void Recycle(void *object, int size);
+
+  // frees all the blocks at once, without calling any destructors
+  void Free();
+
+  // true if some of the objects in the arena are connected to objects outside of it
+  // deleting them one by one is then the only way to disconnect them properly
+  inline bool IsShared() { return shared; }
+  inline void SetShared() { shared = true; }
+
+  // true while the objects in the arena are being thrown away with the arena
+  // rather than being deleted one by one, see Layer::~Layer
+  inline bool& Discarding() { return discarding; }
+
+  // returns a number that changes every time neurons in the arena are connected or
+  // disconnected, so that the schedules and compiled copies of a net only have to
+  // be rebuilt when the net itself changes, see NeuralNet::GetTopologyVersion
+  inline int GetTopologyVersion() { return topologyversion; }
+  void TopologyChanged();
+
+  // allocates an object from the arena, or from the heap if arena is null
+  static void* New(size_t size, Arena *arena);
+
+  // deletes an object of size bytes allocated with New, size may be 0 if it isn't known,
+  // in which case memory from an arena isn't reused
+  static void Delete(void *object, size_t size);
+
+  Arena();
+  ~Arena();
+};
+
 // synapses are used to connect neurons together
 // a connection is made up of 2 such synapses: output and input
 // if you delete either one of them, the other is deleted as well
@@ -17,6 +105,12 @@ protected:
   Synapse *synapse;
 
 public:
+  // synapses are allocated from the arena of the neurons they connect
+  inline void* operator new(size_t size) { return Arena::New(size, null); }
+  inline void* operator new(size_t size, Arena *arena) { return Arena::New(size, arena); }
+  inline void operator delete(void *object, size_t size) { Arena::Delete(object, size); }
+  inline void operator delete(void *object, Arena *) { Arena::Delete(object, 0); }
+
   inline Synapse* GetConnectedSynapse() { return synapse; }
 
   virtual double GetConnectedData();
@@ -45,8 +139,6 @@ protected:
 
 public:
   double weight;
-  double temp;
-
 
   double GetWeight();
 
@@ -69,6 +161,7 @@ typedef double (*WEIGHTFUNCTION)(void);
 // a neuron describes the most basic block of a neural network
 // neurons are contained in neuron groups, see class Group
 // collections of interconnected groups in turn make up the network
+// neurons must be created with new, either on the heap or in an Arena
 class Neuron : public Element
 {
 protected:
@@ -83,9 +176,33 @@ protected:
 
   Bias *bias;
 
+  // see GetArena
+  Arena *arena;
+
+  // tells the neurons visited while building a schedule apart from the rest
+  friend class Schedule;
+  unsigned int mark;
+
+  // changes every time neurons outside of any arena are connected or disconnected
+  static int topologyversion;
+
+  // updates the topology version of the arena of the neuron, or the shared one
+  // if the neuron has no arena
+  friend class Synapse;
+  void ConnectionsChanged();
+
 public:
 
   const static double NoData, ThisNeuron;
+
+  inline void* operator new(size_t size) { return Arena::New(size, null); }
+  inline void* operator new(size_t size, Arena *arena) { return Arena::New(size, arena); }
+  inline void operator delete(void *object, size_t size) { Arena::Delete(object, size); }
+  inline void operator delete(void *object, Arena *) { Arena::Delete(object, 0); }
+
+  // returns the arena the synapses and the bias of the neuron are allocated from,
+  // null if they come from the heap, see Neuron(Arena *, double, double)
+  inline Arena* GetArena() { return arena; }
   
   // InputSynapse
   CleanContainer inputs;
@@ -113,6 +230,16 @@ public:
   // sigmoid transfer function
   static double SigmoidTransfer(double input);
 
+  // hyperbolic tangent, like the sigmoid but with outputs between -1 and 1
+  static double TanhTransfer(double input);
+
+  // rectified linear transfer function, zero for negative inputs
+  static double ReluTransfer(double input);
+
+  // returns the derivative of a transfer function given its output
+  // any function other than the ones above is treated as a sigmoid
+  static double GetDerivative(TRANSFERFUNCTION transfer, double output);
+
   // ...
   // other activation (or transfer) functions can be added here
 
@@ -128,6 +255,7 @@ public:
   // connects this neuron to "neuron"
   // the data from this neuron will now flow there as well
   // weight specifies the weight of the connection
+  // if the neurons are in different arenas the connection is allocated from the heap
   void AddOutput(Neuron *neuron, double weight = 0.0);
 
   // sets the weights
@@ -136,20 +264,40 @@ public:
   // sets the transfer function
   inline void SetTransferFunction(TRANSFERFUNCTION transfer) { TransferFunction = transfer; }
 
+  // returns the transfer function
+  inline TRANSFERFUNCTION GetTransferFunction() { return TransferFunction; }
+
   // clears the data
   inline void Reset() { data = tempdouble = NoData; tempint = 0;}
 
-  // updates this neuron's data by updating the neurons it depends on
-  // summing the weighed inputs and applying the transfer function
+  // updates this neuron's data by summing the weighed inputs and applying
+  // the transfer function, the neurons it depends on must already have been
+  // updated, see class Schedule
   // the result is stored in data and returned from the function
   double Update();
 
+  // returns a number that changes every time neurons outside of any arena are
+  // connected or disconnected, the neurons in an arena change the version of their
+  // arena instead, see Group::GetTopologyVersion
+  inline static int GetTopologyVersion() { return topologyversion; }
+
+  // should be called after the structure of a net has been changed
+  // without connecting or disconnecting neurons, it changes the version of all the groups
+  inline static void TopologyChanged() { topologyversion ++; }
+
   Neuron();
   Neuron(double data);
   Neuron(double data, double bias);
+
+  // a neuron allocated from an arena, new(arena) Neuron(arena, ...), is given the
+  // same arena so that its synapses and its bias are allocated from it as well
+  Neuron(Arena *arena, double data, double bias);
 };
 
 
+template<class real> class CompiledNetT;
+class Schedule;
+
 // class Group describes a group of neurons
 // it makes it easier to connect such groups together
 
@@ -157,6 +305,11 @@ public:
 // NeuralNet does as well, which means that a separate neural network can plugged into another
 class Group : public Element
 {
+protected:
+  // the order in which Update updates the neurons, see GetTopologyVersion
+  Schedule *schedule;
+  int scheduleversion;
+
 public:
 
   // returns the list of input neurons as a container
@@ -173,10 +326,26 @@ public:
   // transfer is a function, see class Neuron
   virtual void SetTransferFunctions(TRANSFERFUNCTION transfer) = 0;
 
-  // updates the neurons starting with the output ones first
-  // see Neuron::Update
+  // sorts the neurons in the order they have to be updated, see class Schedule
+  // called by Update whenever the topology version has changed
+  // returns false if the group contains loops or neurons without inputs
+  virtual bool BuildSchedule();
+
+  // returns the schedule, which also describes any errors found by BuildSchedule
+  // null until the group has been updated for the first time
+  inline Schedule* GetSchedule() { return schedule; }
+
+  // updates the output neurons and all the neurons they depend on
+  // the input neurons are left as they are, see class Schedule
+  // the neurons are only sorted again when the topology version has changed
+  // returns false if the neurons can't be ordered
   virtual bool Update();
 
+  // returns a number that changes whenever the neurons of the group are connected
+  // or disconnected, schedules and compiled nets built before it changed may be out of date
+  // by default it's Neuron::GetTopologyVersion, which doesn't cover neurons in arenas
+  virtual int GetTopologyVersion();
+
   // connects every single output neuron in this group to
   // every input neuron in "group"
   virtual void Connect(Group *group);
@@ -189,9 +358,88 @@ public:
 
   // clears the data for every neuron in this group
   virtual void Reset() = 0;
+
+  Group();
+  virtual ~Group();
   };
 
 
+// a schedule lists the neurons of a group in the order in which they have to be updated,
+// each neuron comes after all the neurons it receives data from
+// it is built once by sorting the neurons topologically without recursion,
+// after which updating the group is just a loop over the list
+class Schedule
+{
+protected:
+  Neuron **neurons;
+  int count;
+
+  // the stack used while sorting
+  Neuron **stack;
+  InputSynapse **stackinputs;
+  int stacksize;
+
+  int capacity, stackcapacity;
+
+  int error;
+  Neuron *errorneuron;
+  char message[512];
+
+  // the stamp of the current build, see Build
+  // it's taken from a counter shared by all the schedules, the schedules
+  // of different nets may be built on several threads at once
+  unsigned int stamp;
+  static unsigned int laststamp;
+  static Mutex stampmutex;
+
+  // adds a neuron to the end of the list
+  void Add(Neuron *neuron);
+
+  // pushes a neuron onto the stack
+  void Push(Neuron *neuron);
+
+  // sets the error and its message
+  void SetError(int error, Neuron *neuron, ::Container *groups);
+
+  // appends a description of the neuron to the message
+  void Describe(Neuron *neuron, ::Container *groups);
+
+public:
+
+  enum Error { NoError, Loop, NoInputs };
+
+  // sorts the neurons needed to update the output neurons of group
+  // the input neurons of group are treated as given and aren't included
+  // groups is optional and is only used to describe neurons in error messages
+  // returns false if there is a loop or a neuron without inputs, see GetError
+  bool Build(Group *group, ::Container *groups = null);
+
+  // updates all the neurons in the order they have been sorted
+  void Update();
+
+  // empties the schedule
+  void Clear();
+
+  // returns the number of neurons in the schedule
+  inline int GetSize() { return count; }
+
+  // returns the neurons in the order they are updated
+  inline Neuron** GetNeurons() { return neurons; }
+
+  // returns the error found by Build, see enum Error
+  inline int GetError() { return error; }
+
+  // returns the neuron that caused the error
+  inline Neuron* GetErrorNeuron() { return errorneuron; }
+
+  // returns a description of the error, including the neurons involved
+  inline const char* GetErrorMessage() { return message; }
+
+  Schedule();
+  ~Schedule();
+};
+
+
 // a Layer is the most basic neuron Group
 // where each input neuron is also an output
 // there are no connections between neurons in a Layer
@@ -200,14 +448,21 @@ public:
 // and set up connections within the layer as well
 class Layer : public Group
 {
+protected:
+  Arena *arena;
+
+  // see SetSoftmax
+  bool softmax;
+
 public:
-  CleanContainer neurons;
+  IndexedCleanContainer neurons;
 
   // returns the list of input neurons as a container
-  ::Container* GetInputs();
+  // the container is indexed, so Get and GetIndex take constant time
+  IndexedContainer* GetInputs();
 
-  // returns the list of output neurons as a container
-  ::Container* GetOutputs();
+  // returns the list of output neurons as a container, see GetInputs
+  IndexedContainer* GetOutputs();
 
   // sets the weights for all the neurons in this group
   // weight is a function, see class Neuron
@@ -220,29 +475,74 @@ public:
   // resets all the neurons in this group
   void Reset();
 
+  // turns the output layer of a net into a softmax layer, whose outputs are
+  // exp of the sums of the neurons divided by the total of them all, so they are
+  // positive and add up to 1, like the probabilities of the classes of a classifier
+  // the neurons get the linear transfer function and keep it, SetTransferFunctions
+  // doesn't change them while the layer is a softmax layer
+  // the trainers then minimise the cross-entropy instead of the squared error,
+  // see BPTrainer::Train and CompiledNet::Backpropagate
+  // only the output layer of a net, the last of its groups, can be a softmax layer,
+  // for any other layer it returns false and leaves the layer as it is
+  bool SetSoftmax(bool softmax);
+  inline bool IsSoftmax() { return softmax; }
+
+  // returns the arena the neurons were allocated from
+  inline Arena* GetArena() { return arena; }
+
+  // changes when the neurons of the arena, or neurons outside of any arena, are connected
+  int GetTopologyVersion();
+
   // creates a new layer with the specified number of neurons
-  Layer(int size);
+  // the neurons are allocated from arena, or from the heap if it's null
+  Layer(int size, Arena *arena = null);
+
+  // deletes the neurons, unless their arena is being discarded
+  ~Layer();
 };
 
 // a neural net describes a collection of neuron groups
 class NeuralNet : public Group
 {
 protected:
+  // the neurons and synapses of the net, declared first so that it's destroyed last
+  Arena arena;
+
   Layer *input, *output;
-  CleanContainer groups;
+  IndexedCleanContainer groups;
+
+  // see SetPrecision
+  int precision;
+
+  // the compiled copies used by UpdateBatch, compiled again only when the topology
+  // version has changed, otherwise the weights are just reloaded
+  CompiledNetT<double> *compiled;
+  CompiledNetT<float> *floatcompiled;
+  int compiledversion, floatversion;
+
+  // the batch converted to floats and back in Float precision
+  MemoryBuffer floatinputs, floatoutputs;
+
+  // deletes all the groups, if none of the neurons in the arena are connected
+  // to neurons outside of it, the whole arena is freed at once
+  void DeleteGroups();
 
 public:
 
-  // returns the list of input neurons as a container
-  ::Container* GetInputs();
+  // returns the list of input neurons as a container, see Layer::GetInputs
+  IndexedContainer* GetInputs();
 
-  // returns the list of output neurons as a container
-  ::Container* GetOutputs();
+  // returns the list of output neurons as a container, see Layer::GetInputs
+  IndexedContainer* GetOutputs();
 
   inline Layer* GetInputLayer() { return input; }
   inline Layer* GetOutputLayer() { return output; }
 
-  inline ::Container* GetGroups() { return &groups; }
+  // returns the list of groups, which is indexed like the neurons of a layer
+  inline IndexedContainer* GetGroups() { return &groups; }
+
+  // returns the arena from which the neurons of the net are allocated
+  inline Arena* GetArena() { return &arena; }
 
   // adds a Group to the list of groups, treating it as a layer
   // it is inserted between the last hidden layer and the output layer
@@ -258,14 +558,44 @@ public:
   // transfer is a function, see class Neuron
   void SetTransferFunctions(TRANSFERFUNCTION transfer);
 
+  // sorts the neurons like Group::BuildSchedule, naming the layers in the error messages
+  bool BuildSchedule();
+
+  // changes when the neurons of the arena of the net, or neurons outside of any arena,
+  // are connected or disconnected, or when groups are added to the net
+  // changes to the other nets don't affect it
+  int GetTopologyVersion();
+
+  // updates the net with the data already in the input neurons, see Group::Update
+  using Group::Update;
+
+  enum Precision { Double, Float };
+
+  // sets the precision of the weights when the net is saved or compiled
+  // the neurons themselves always work with doubles, but a net in Float
+  // precision is saved with float weights and UpdateBatch compiles it
+  // to a FloatCompiledNet, which needs half the memory and bandwidth
+  // the trainers ignore it and always train in double precision, see BPTrainer
+  inline void SetPrecision(int precision) { this->precision = precision; }
+  inline int GetPrecision() { return precision; }
+
   // feeds the contents of the inputbuffer to the input neurons
   // and grabs the output from the output neurons
-  // neural nets are updated recursively starting from the output neurons first
-  // see Neuron::Update
-  bool Update(double *inputbuffer, double *outputbuffer);
+  // the neurons are updated in the order given by the schedule
+  // the softmax of a softmax output layer is applied to the data of its neurons as well
+  // returns false if the schedule couldn't be built
+  bool Update(const double *inputbuffer, double *outputbuffer);
+
+  // updates a batch of n samples, inputs holds n rows of input data
+  // and n rows of output data are written to outputs
+  // the net is compiled so every layer is processed for the whole batch at once,
+  // see CompiledNet::UpdateBatch, nets that can't be compiled are updated one sample at a time
+  // the compiled copy is kept for the following calls, which only reload the weights
+  // unless the structure of the net has changed, see CompiledNet::Reload
+  // in Float precision the data is converted to floats and back
+  bool UpdateBatch(const double *inputs, int n, double *outputs);
 
   // resets all the neurons in this net by removing any data they contain
-  // called internally in Update
   void Reset();
 
   // bool Verify();
@@ -273,6 +603,8 @@ public:
 
   // creates a new net with the specified number of input and output neurons
   NeuralNet(int inputcount, int outputcount);
+
+  ~NeuralNet();
 };
 
 
@@ -280,13 +612,28 @@ public:
 // remember to call ConnectGroups after the layers have been added
 class LayeredNet : public NeuralNet
 {
+protected:
+  // files start with a tag, which can't be confused with the number of layers
+  // that older files start with, followed by the version and the precision
+  // since version 2 the size of each layer is followed by its flags
+  enum { FileTag = -1, FileVersion = 2 };
+  enum LayerFlags { SoftmaxLayer = 1 };
+
 public:
   inline void AddLayer(Layer *layer) { AddGroup(layer); }
+
+  // creates a layer of the given size in the arena of the net and adds it
+  inline Layer* AddLayer(int size) { Layer *layer = new Layer(size, &arena); AddGroup(layer); return layer; }
   LayeredNet(int inputcount, int outputcount) : NeuralNet(inputcount, outputcount) {}
 
   Neuron* GetNeuron(int groupindex, int neuronindex);
 
+  // the weights are saved as doubles or floats depending on the precision of the net
+  // along with the softmax flag of each layer, the transfer functions aren't saved
   virtual bool Save(FILE *file);
+
+  // loads files in the current and in the older format, which has no header
+  // and only doubles, the precision of the net is set to that of the file
   virtual bool Load(FILE *file);
 };
 
@@ -294,6 +641,8 @@ public:
 typedef void (*INPUTFUNCTION)(double *input, int state);
 typedef void (*TRAINFUNCTION)(double *input, double *output);
 
+class Dataset;
+
 // the NetTrainer class provides the basic facilities for
 // training a network
 class NetTrainer
@@ -308,6 +657,19 @@ protected:
   INPUTFUNCTION input;
   TRAINFUNCTION train;
 
+  // the samples, see SetDataset
+  Dataset *dataset;
+
+  // points inputs and targets at the inputs and the desired outputs for a state
+  // which are either in the dataset or stored in inputbuffer and outputbuffer1
+  void GetSample(int state, const double *&inputs, const double *&targets);
+
+  // the same for n states, the samples are one after the other, either in the dataset
+  // if the states are consecutive and the dataset has a view of them, see Dataset::GetView,
+  // or copied into inputbuffer and targetbuffer, which must have room for n samples
+  void GetSamples(const int *states, int n, double *inputbuffer, double *targetbuffer,
+                  const double *&inputs, const double *&targets);
+
 public:
 
   const static double TrainError;
@@ -315,14 +677,16 @@ public:
   inline void SetInputFunction(INPUTFUNCTION input) { this->input = input; }
   inline void SetTrainFunction(TRAINFUNCTION train) { this->train = train; }
 
+  // trains on the samples of a dataset instead of calling the input and train functions
+  // the state passed to the trainer is then the index of the sample
+  // the dataset isn't owned by the trainer, a null dataset goes back to the functions
+  // returns false if the dataset doesn't have the trainer's number of inputs and outputs
+  bool SetDataset(Dataset *dataset);
+  inline Dataset* GetDataset() { return dataset; }
+
   // virtual double Train(int state) = 0;
   
   NetTrainer(int inputcount, int outputcount);
   ~NetTrainer();
 };
 
-
-class Arena
-{
-
-};
@@ -0,0 +1,69 @@
+#include <math.h>
+#include <memory.h>
+#include "Optimizer.h"
+#include "Kernels.h"
+
+Optimizer::Optimizer(int count) : state(null), statecount(count), paramcount(0), steps(0)
+{
+}
+
+Optimizer::~Optimizer()
+{
+  safe_delete_array(state);
+}
+
+void Optimizer::Prepare(int count)
+{
+  if(count != paramcount || state == null) {
+    safe_delete_array(state);
+    paramcount = count;
+    state = new double[statecount * paramcount];
+    Reset();
+  }
+
+  steps ++;
+}
+
+void Optimizer::Reset()
+{
+  if(state != null)
+    memset(state, 0, statecount * paramcount * sizeof(double));
+  steps = 0;
+}
+
+MomentumOptimizer::MomentumOptimizer(double m) : Optimizer(1), momentum(m)
+{
+}
+
+void MomentumOptimizer::Update(double *params, const double *gradients, int first, int last,
+                               double rate, double scale)
+{
+  Kernels::Double.MomentumStep(params + first, gradients + first, GetState(0) + first,
+    last - first, rate, scale, momentum);
+}
+
+RMSPropOptimizer::RMSPropOptimizer(double d, double e) : Optimizer(1), decay(d), epsilon(e)
+{
+}
+
+void RMSPropOptimizer::Update(double *params, const double *gradients, int first, int last,
+                              double rate, double scale)
+{
+  Kernels::Double.RMSPropStep(params + first, gradients + first, GetState(0) + first,
+    last - first, rate, scale, decay, epsilon);
+}
+
+AdamOptimizer::AdamOptimizer(double b1, double b2, double e) : Optimizer(2), beta1(b1), beta2(b2), epsilon(e)
+{
+}
+
+void AdamOptimizer::Update(double *params, const double *gradients, int first, int last,
+                           double rate, double scale)
+{
+  // the averages start at zero, which makes them too small during the first steps
+  // correcting the rate makes up for it
+  double corrected = rate * sqrt(1.0 - pow(beta2, steps)) / (1.0 - pow(beta1, steps));
+
+  Kernels::Double.AdamStep(params + first, gradients + first, GetState(0) + first, GetState(1) + first,
+    last - first, corrected, scale, beta1, beta2, epsilon);
+}
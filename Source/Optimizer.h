@@ -0,0 +1,96 @@
+#pragma once
+
+#include "Util.h"
+
+// an optimizer changes the weights and biases of a compiled net by their gradients,
+// see BPTrainer::SetOptimizer
+// whatever it remembers about the parameters between the steps is kept in arrays
+// of its own, one number per parameter in the same order as the parameters,
+// so the synapses don't grow and every step is a pass over contiguous memory
+class Optimizer
+{
+protected:
+  // the state arrays, paramcount numbers each, one after the other
+  double *state;
+  int statecount;
+  int paramcount;
+
+  // the number of steps since the state was reset
+  int steps;
+
+  inline double* GetState(int i) { return state + i * paramcount; }
+
+public:
+
+  // prepares a step for count parameters, called once before Update on each step
+  // the state is reset when the number of parameters changes
+  void Prepare(int count);
+
+  // changes the parameters first to last - 1 by their gradients, multiplied by scale
+  // rate is the step, see BPTrainer::Step
+  // several threads may update different ranges of the parameters at once
+  virtual void Update(double *params, const double *gradients, int first, int last,
+                      double rate, double scale) = 0;
+
+  // forgets the state, as if no steps had been taken
+  void Reset();
+
+  // creates an optimizer with statecount numbers for each parameter
+  Optimizer(int statecount);
+  virtual ~Optimizer();
+};
+
+// momentum adds a fraction of the previous step to each step, which speeds up
+// the descent along directions where the gradients agree from step to step
+class MomentumOptimizer : public Optimizer
+{
+protected:
+  double momentum;
+
+public:
+  // the fraction of the previous step, usually around 0.9
+  inline double& Momentum() { return momentum; }
+
+  void Update(double *params, const double *gradients, int first, int last, double rate, double scale);
+
+  MomentumOptimizer(double momentum = 0.9);
+};
+
+// RMSProp divides the gradient of each parameter by a running average
+// of its magnitude, so all the parameters learn at a similar pace
+class RMSPropOptimizer : public Optimizer
+{
+protected:
+  double decay, epsilon;
+
+public:
+  // how slowly the average of the squared gradients changes, usually around 0.9
+  inline double& Decay() { return decay; }
+
+  // added to the magnitude to avoid dividing by zero
+  inline double& Epsilon() { return epsilon; }
+
+  void Update(double *params, const double *gradients, int first, int last, double rate, double scale);
+
+  RMSPropOptimizer(double decay = 0.9, double epsilon = 1e-8);
+};
+
+// Adam combines momentum with the scaling of RMSProp, the averages are
+// corrected for starting at zero, good steps are usually around 0.001
+class AdamOptimizer : public Optimizer
+{
+protected:
+  double beta1, beta2, epsilon;
+
+public:
+  // how slowly the averages of the gradients and of their squares change
+  inline double& Beta1() { return beta1; }
+  inline double& Beta2() { return beta2; }
+
+  // added to the magnitude to avoid dividing by zero
+  inline double& Epsilon() { return epsilon; }
+
+  void Update(double *params, const double *gradients, int first, int last, double rate, double scale);
+
+  AdamOptimizer(double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8);
+};
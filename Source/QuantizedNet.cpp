@@ -0,0 +1,173 @@
+#include <math.h>
+#include <memory.h>
+#include "QuantizedNet.h"
+#include "Kernels.h"
+
+QuantizedNet::QuantizedNet() : weights(null), biases(null), weightscales(null), datascales(null),
+  deviation(0.0)
+{
+}
+
+QuantizedNet::~QuantizedNet()
+{
+  Clear();
+}
+
+void QuantizedNet::Clear()
+{
+  safe_delete_array(weights);
+  safe_delete_array(biases);
+  safe_delete_array(weightscales);
+  safe_delete_array(datascales);
+  data.Clear();
+  quantizeddata.Clear();
+  deviation = 0.0;
+
+  CompiledNet::Clear();
+}
+
+void QuantizedNet::QuantizeData(const double *in, signed char *out, int count, double scale)
+{
+  double inverse = 1.0 / scale;
+  for(int i = 0; i < count; i ++) {
+    double q = floor(in[i] * inverse + 0.5);
+    out[i] = (signed char)min(127.0, max(-127.0, q));
+  }
+}
+
+bool QuantizedNet::Quantize(NeuralNet *net, const double *calibration, int n, int granularity)
+{
+  Clear();
+
+  if(!Compile(net))
+    return false;
+
+  // run the calibration set through the compiled net, which keeps the data of every stage
+  double *reference = new double[n * GetOutputCount()];
+  CompiledNet::UpdateBatch(calibration, n, reference);
+
+  datascales = new double[stagecount];
+  for(int s = 0; s < stagecount; s ++) {
+    double *stagedata = GetStageData(&stages[s], n);
+    double range = 0.0;
+    for(int i = 0; i < n * stages[s].size; i ++)
+      range = max(range, fabs(stagedata[i]));
+
+    datascales[s] = range > 0.0 ? range / 127.0 : 1.0;
+  }
+  batch.Clear();
+
+  // the weight blocks keep their offsets, the slots of the biases stay unused
+  weights = new signed char[paramcount];
+  memset(weights, 0, paramcount);
+  biases = new double[datacount];
+  weightscales = new double[datacount];
+
+  for(int i = 0; i < stages[0].size; i ++)
+    biases[i] = weightscales[i] = 0.0;
+
+  for(int s = 1; s < stagecount; s ++) {
+    Stage *stage = &stages[s];
+    double *scales = weightscales + stage->data;
+
+    // find the largest weight of every row
+    double layerrange = 0.0;
+    for(int j = 0; j < stage->size; j ++) {
+      biases[stage->data + j] = params[stage->bias + j];
+
+      double range = 0.0;
+      for(int b = 0; b < stage->blockcount; b ++) {
+        Block *block = &blocks[stage->firstblock + b];
+        int k = stages[block->source].size;
+        double *row = params + block->weights + j * k;
+        for(int i = 0; i < k; i ++)
+          range = max(range, fabs(row[i]));
+      }
+
+      scales[j] = range;
+      layerrange = max(layerrange, range);
+    }
+
+    for(int j = 0; j < stage->size; j ++) {
+      double range = granularity == PerLayer ? layerrange : scales[j];
+      scales[j] = range > 0.0 ? range / 127.0 : 1.0;
+    }
+
+    for(int b = 0; b < stage->blockcount; b ++) {
+      Block *block = &blocks[stage->firstblock + b];
+      int k = stages[block->source].size;
+      for(int j = 0; j < stage->size; j ++)
+        QuantizeData(params + block->weights + j * k, weights + block->weights + j * k, k, scales[j]);
+    }
+  }
+
+  safe_delete_array(params);
+
+  data.GetBuffer(datacount * sizeof(double));
+  quantizeddata.GetBuffer(datacount);
+
+  // compare the quantized net with the original one
+  int count = n * GetOutputCount();
+  double *outputs = new double[count];
+  UpdateBatch(calibration, n, outputs);
+
+  for(int i = 0; i < count; i ++)
+    deviation = max(deviation, fabs(outputs[i] - reference[i]));
+
+  delete[] outputs;
+  delete[] reference;
+  return true;
+}
+
+void QuantizedNet::UpdateSample(const double *inputs, double *outputs)
+{
+  double *values = (double *)data.GetBuffer();
+  signed char *quantized = (signed char *)quantizeddata.GetBuffer();
+
+  QuantizeData(inputs, quantized, stages[0].size, datascales[0]);
+
+  for(int s = 1; s < stagecount; s ++) {
+    Stage *stage = &stages[s];
+    double *out = values + stage->data;
+    double *scales = weightscales + stage->data;
+
+    memcpy(out, biases + stage->data, stage->size * sizeof(double));
+
+    for(int b = 0; b < stage->blockcount; b ++) {
+      Block *block = &blocks[stage->firstblock + b];
+      Stage *source = &stages[block->source];
+      signed char *in = quantized + source->data;
+      signed char *rows = weights + block->weights;
+      double sourcescale = datascales[block->source];
+
+      for(int j = 0; j < stage->size; j ++)
+        out[j] += Kernels::QuantizedDot(rows + j * source->size, in, source->size) * scales[j] * sourcescale;
+    }
+
+    ApplyTransfer(stage, out, 0, stage->size);
+    if(stage->softmax)
+      Kernels::Double.Softmax(out, stage->size);
+
+    if(s < stagecount - 1)
+      QuantizeData(out, quantized + stage->data, stage->size, datascales[s]);
+  }
+
+  Stage *output = &stages[stagecount - 1];
+  memcpy(outputs, values + output->data, output->size * sizeof(double));
+}
+
+bool QuantizedNet::Update(double *inputbuffer, double *outputbuffer)
+{
+  return UpdateBatch(inputbuffer, 1, outputbuffer);
+}
+
+bool QuantizedNet::UpdateBatch(const double *inputs, int n, double *outputs)
+{
+  if(stagecount == 0 || weights == null) return false;
+
+  int inputcount = GetInputCount(), outputcount = GetOutputCount();
+  for(int r = 0; r < n; r ++)
+    UpdateSample(inputs + r * inputcount, outputs + r * outputcount);
+
+  return true;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "CompiledNet.h"
+
+// a quantized net is a compiled net whose weights are stored as 8 bit integers
+// which makes them 8 times smaller than doubles, for machines where the memory
+// bandwidth is the limit
+
+// each row of weights has a scale, either its own or one shared by the whole layer,
+// and the weights are rounded to integers between -127 and 127 times that scale
+// the neuron data fed to the weights is quantized the same way, with one scale per layer
+// found by running a calibration set through the net
+// the products are summed up in 32 bit integers and multiplied by both scales
+// before the bias is added and the transfer function is applied in doubles
+
+// like a compiled net, the quantized net is a snapshot of the original net
+// it's built on a compiled net, but the double weights are freed after quantizing,
+// so it inherits privately and only the 8 bit interface below is available,
+// the methods of CompiledNet working with the weights can't be called on it
+class QuantizedNet : private CompiledNet
+{
+protected:
+
+  // the quantized weights, at the same offsets as the weights in the parameter buffer
+  signed char *weights;
+
+  // the biases of every neuron and the scale of its row of weights
+  double *biases;
+  double *weightscales;
+
+  // the scale of the quantized data of every stage
+  double *datascales;
+
+  // the largest difference between the outputs of the quantized
+  // and the original net over the calibration set
+  double deviation;
+
+  // the data of the sample being updated, as doubles and quantized
+  MemoryBuffer data;
+  MemoryBuffer quantizeddata;
+
+  // quantizes count numbers with the given scale
+  static void QuantizeData(const double *in, signed char *out, int count, double scale);
+
+  // updates a single sample
+  void UpdateSample(const double *inputs, double *outputs);
+
+public:
+
+  enum Granularity { PerLayer, PerNeuron };
+
+  // compiles and quantizes the net, all the groups in it must be layers,
+  // see CompiledNet::Compile
+  // the n samples in calibration, one row of inputs each, set the range of
+  // the data in each layer and should be representative of the real inputs
+  // granularity chooses between one weight scale per layer or per neuron,
+  // the latter is more accurate when the weights of the neurons differ a lot
+  // returns false if the net can't be compiled
+  bool Quantize(NeuralNet *net, const double *calibration, int n, int granularity = PerNeuron);
+
+  // frees the quantized data
+  void Clear();
+
+  using CompiledNet::GetInputCount;
+  using CompiledNet::GetOutputCount;
+  using CompiledNet::GetLayerCount;
+
+  // returns the largest absolute difference between any output of the quantized net
+  // and the original one over the calibration set
+  inline double GetMaxDeviation() { return deviation; }
+
+  // returns the memory taken by the weights, biases and scales in bytes
+  inline int GetParameterSize() { return paramcount + (2 * datacount + stagecount) * (int)sizeof(double); }
+
+  // feeds the contents of the inputbuffer to the input neurons
+  // and grabs the output from the output neurons, see NeuralNet::Update
+  bool Update(double *inputbuffer, double *outputbuffer);
+
+  // updates a batch of n samples, see CompiledNet::UpdateBatch
+  // the samples are updated one by one, the quantized weights are small
+  // enough to mostly stay in the cache between them
+  bool UpdateBatch(const double *inputs, int n, double *outputs);
+
+  QuantizedNet();
+  ~QuantizedNet();
+};
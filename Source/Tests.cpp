@@ -0,0 +1,974 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "QuantizedNet.h"
+#include "BPNet.h"
+#include "CsvConverter.h"
+#include "Evaluator.h"
+#include "GANet.h"
+
+// regression checks, each prints what it compared and returns false if it failed
+// runchecks runs all of them, Main runs it when it's started with -check
+// the files the checks write to the current directory are removed afterwards
+
+
+// prints the result of a check
+bool report(const char *name, bool passed, double difference)
+{
+  printf("%s: %s (%g)\n", name, passed ? "passed" : "FAILED", difference);
+  return passed;
+}
+
+
+// a net with two hidden layers, a connection skipping them and mixed transfer functions
+LayeredNet* createchecknet(int inputcount, int outputcount)
+{
+  LayeredNet *net = new LayeredNet(inputcount, outputcount);
+  net->AddLayer(7);
+  Layer *hidden = net->AddLayer(5);
+  net->ConnectGroups();
+  net->GetInputLayer()->Connect(net->GetOutputLayer());
+
+  net->SetTransferFunctions(Neuron::TanhTransfer);
+  hidden->SetTransferFunctions(Neuron::ReluTransfer);
+  ((Neuron*)net->GetOutputLayer()->GetOutputs()->Get(0))->SetTransferFunction(Neuron::SigmoidTransfer);
+  net->SetWeights(Neuron::RandomWeights);
+
+  return net;
+}
+
+
+// the largest difference between two arrays
+double maxdifference(const double *a, const double *b, int count)
+{
+  double difference = 0;
+  for(int i = 0; i < count; i ++)
+    if(fabs(a[i] - b[i]) > difference) difference = fabs(a[i] - b[i]);
+  return difference;
+}
+
+//*******************************************
+// compiled nets
+
+// the outputs of a CompiledNet must be the same as the ones of the net it was compiled from
+// and a net with a loop mustn't compile
+bool checkcompiled()
+{
+  const int INPUTS = 4, OUTPUTS = 3;
+  LayeredNet *net = createchecknet(INPUTS, OUTPUTS);
+
+  CompiledNet compiled;
+  bool passed = compiled.Compile(net);
+  passed = passed && compiled.GetInputCount() == INPUTS && compiled.GetOutputCount() == OUTPUTS;
+  double difference = 0;
+
+  for(int i = 0; i < 20 && passed; i ++) {
+    double inputs[INPUTS], graph[OUTPUTS], single[OUTPUTS];
+    for(int j = 0; j < INPUTS; j ++)
+      inputs[j] = Random::GetDouble(-2, 2);
+    passed = net->Update(inputs, graph) && compiled.Update(inputs, single);
+    difference = fmax(difference, maxdifference(graph, single, OUTPUTS));
+  }
+
+  // connect the output layer back to the last hidden one
+  Neuron *output = (Neuron *)net->GetOutputLayer()->GetOutputs()->Get(0);
+  output->AddOutput((Neuron *)((Group *)net->GetGroups()->Get(2))->GetOutputs()->Get(0));
+  passed = passed && !compiled.Compile(net);
+
+  delete net;
+  return report("compiled outputs", passed && difference < 1e-12, difference);
+}
+
+
+// UpdateBatch must give the outputs of Update, also after new weights are set,
+// which the compiled copy it caches has to pick up, and Reload must do the same
+bool checkbatch()
+{
+  const int n = 20, INPUTS = 4, OUTPUTS = 3;
+  LayeredNet *net = createchecknet(INPUTS, OUTPUTS);
+
+  double inputs[n * INPUTS], graph[n * OUTPUTS], batch[n * OUTPUTS];
+  for(int i = 0; i < n * INPUTS; i ++)
+    inputs[i] = Random::GetDouble(-2, 2);
+
+  CompiledNet compiled;
+  bool passed = compiled.Compile(net);
+  double difference = 0;
+
+  for(int pass = 0; pass < 2 && passed; pass ++) {
+    for(int i = 0; i < n; i ++)
+      passed = passed && net->Update(inputs + i * INPUTS, graph + i * OUTPUTS);
+
+    passed = passed && net->UpdateBatch(inputs, n, batch);
+    difference = fmax(difference, maxdifference(graph, batch, n * OUTPUTS));
+
+    passed = passed && compiled.Reload(net) && compiled.UpdateBatch(inputs, n, batch);
+    difference = fmax(difference, maxdifference(graph, batch, n * OUTPUTS));
+
+    net->SetWeights(Neuron::RandomWeights);
+  }
+
+  delete net;
+  return report("batch outputs", passed && difference < 1e-12, difference);
+}
+
+
+// in Float precision UpdateBatch must give the outputs of Update to float precision
+bool checkfloat()
+{
+  const int n = 20, INPUTS = 4, OUTPUTS = 3;
+  LayeredNet *net = createchecknet(INPUTS, OUTPUTS);
+
+  double inputs[n * INPUTS], graph[n * OUTPUTS], batch[n * OUTPUTS];
+  for(int i = 0; i < n * INPUTS; i ++)
+    inputs[i] = Random::GetDouble(-2, 2);
+
+  bool passed = true;
+  double difference = 0;
+
+  net->SetPrecision(NeuralNet::Float);
+  for(int pass = 0; pass < 2 && passed; pass ++) {
+    for(int i = 0; i < n; i ++)
+      passed = passed && net->Update(inputs + i * INPUTS, graph + i * OUTPUTS);
+
+    passed = passed && net->UpdateBatch(inputs, n, batch);
+    difference = fmax(difference, maxdifference(graph, batch, n * OUTPUTS));
+
+    net->SetWeights(Neuron::RandomWeights);
+  }
+
+  delete net;
+  return report("float outputs", passed && difference < 1e-4, difference);
+}
+
+//*******************************************
+// saving and loading
+
+// a net loaded from a file must give the same outputs as the one saved,
+// to float precision if it was saved in Float precision
+// the transfer functions aren't saved, Load sets them all to sigmoids,
+// but a softmax output layer must stay one, and only the output layer can be one
+bool checksaveload()
+{
+  const int INPUTS = 3, OUTPUTS = 4;
+  double inputs[INPUTS] = { 0.1, -0.5, 0.9 }, saved[OUTPUTS], loaded[OUTPUTS];
+  double difference = 0, floatdifference = 0;
+  bool passed = true;
+
+  for(int precision = NeuralNet::Double; precision <= NeuralNet::Float; precision ++) {
+    LayeredNet *net = createchecknet(INPUTS, OUTPUTS);
+    net->SetTransferFunctions(Neuron::SigmoidTransfer);
+    passed = passed && !net->GetInputLayer()->SetSoftmax(true);
+    passed = passed && !((Layer*)net->GetGroups()->Get(1))->SetSoftmax(true);
+    passed = passed && net->GetOutputLayer()->SetSoftmax(true);
+    net->SetPrecision(precision);
+    net->Update(inputs, saved);
+
+    LayeredNet *copy = new LayeredNet(1, 1);
+    FILE *file = fopen("check.net", "wb");
+    passed = passed && file != null && net->Save(file);
+    if(file != null) fclose(file);
+    file = fopen("check.net", "rb");
+    passed = passed && file != null && copy->Load(file);
+    if(file != null) fclose(file);
+
+    passed = passed && copy->GetPrecision() == precision;
+    passed = passed && copy->GetOutputLayer()->IsSoftmax() && !copy->GetInputLayer()->IsSoftmax();
+    passed = passed && copy->Update(inputs, loaded);
+    double &result = precision == NeuralNet::Double ? difference : floatdifference;
+    result = maxdifference(saved, loaded, OUTPUTS);
+
+    delete net;
+    delete copy;
+  }
+
+  remove("check.net");
+  return report("save and load", passed && difference < 1e-12 && floatdifference < 1e-5, difference);
+}
+
+
+//*******************************************
+// quantized nets
+
+// the deviation reported by a QuantizedNet must be the largest difference between
+// its outputs and the ones of the net over the calibration set, it must be small,
+// smaller with a scale per neuron when the weights of one neuron are a lot larger,
+// and UpdateBatch must give the outputs of Update
+bool checkquantized()
+{
+  const int n = 50, INPUTS = 6, OUTPUTS = 3;
+  LayeredNet *net = new LayeredNet(INPUTS, OUTPUTS);
+  Layer *hidden = net->AddLayer(10);
+  net->ConnectGroups();
+  net->SetTransferFunctions(Neuron::SigmoidTransfer);
+  net->SetWeights(Neuron::RandomWeights);
+
+  forEach(InputSynapse, ((Neuron *)hidden->neurons.Elements())->inputs, input)
+    input->weight *= 50;
+
+  double calibration[n * INPUTS], graph[n * OUTPUTS], quantized[n * OUTPUTS], batch[n * OUTPUTS];
+  for(int i = 0; i < n * INPUTS; i ++)
+    calibration[i] = Random::GetDouble();
+  for(int i = 0; i < n; i ++)
+    net->Update(calibration + i * INPUTS, graph + i * OUTPUTS);
+
+  bool passed = true;
+  double deviations[2], difference = 0;
+
+  for(int granularity = QuantizedNet::PerLayer; granularity <= QuantizedNet::PerNeuron; granularity ++) {
+    QuantizedNet net8;
+    passed = passed && net8.Quantize(net, calibration, n, granularity);
+    passed = passed && net8.GetInputCount() == INPUTS && net8.GetOutputCount() == OUTPUTS;
+    if(!passed) break;
+
+    for(int i = 0; i < n; i ++)
+      net8.Update(calibration + i * INPUTS, quantized + i * OUTPUTS);
+    deviations[granularity] = net8.GetMaxDeviation();
+    difference = fmax(difference, fabs(maxdifference(graph, quantized, n * OUTPUTS) - deviations[granularity]));
+
+    passed = passed && net8.UpdateBatch(calibration, n, batch);
+    difference = fmax(difference, maxdifference(quantized, batch, n * OUTPUTS));
+  }
+
+  delete net;
+  passed = passed && deviations[QuantizedNet::PerNeuron] < 0.05;
+  passed = passed && deviations[QuantizedNet::PerNeuron] < deviations[QuantizedNet::PerLayer];
+  return report("quantized outputs", passed && difference < 1e-12, deviations[QuantizedNet::PerNeuron]);
+}
+
+
+//*******************************************
+// training
+
+// the gradients of CompiledNet::Backpropagate must match finite differences
+// of the error, half the sum of the squared differences
+bool checkgradients()
+{
+  const int n = 6, INPUTS = 3, OUTPUTS = 2;
+  LayeredNet *net = createchecknet(INPUTS, OUTPUTS);
+  ((Neuron*)net->GetOutputLayer()->GetOutputs()->Get(1))->SetTransferFunction(Neuron::LinearTransfer);
+
+  CompiledNet compiled;
+  bool passed = compiled.Compile(net);
+  delete net;
+  if(!passed) return report("gradients", false, 0);
+
+  double inputs[n * INPUTS], targets[n * OUTPUTS], outputs[n * OUTPUTS];
+  for(int i = 0; i < n * INPUTS; i ++)
+    inputs[i] = Random::GetDouble(-1, 1);
+  for(int i = 0; i < n * OUTPUTS; i ++)
+    targets[i] = Random::GetDouble(-1, 1);
+
+  int count = compiled.GetParameterCount();
+  double *params = compiled.GetParameters();
+  double *gradients = new double[count];
+  memset(gradients, 0, count * sizeof(double));
+
+  compiled.UpdateBatch(inputs, n, outputs);
+  compiled.Backpropagate(targets, n, gradients);
+
+  double difference = 0, step = 1e-6;
+  for(int i = 0; i < count; i ++) {
+    double weight = params[i], errors[2] = { 0, 0 };
+    for(int k = 0; k < 2; k ++) {
+      params[i] = weight + (k == 0 ? step : -step);
+      compiled.UpdateBatch(inputs, n, outputs);
+      for(int j = 0; j < n * OUTPUTS; j ++)
+        errors[k] += 0.5 * (outputs[j] - targets[j]) * (outputs[j] - targets[j]);
+    }
+    params[i] = weight;
+    difference = fmax(difference, fabs((errors[0] - errors[1]) / (2 * step) - gradients[i]));
+  }
+
+  safe_delete_array(gradients);
+  return report("gradients", difference < 1e-5, difference);
+}
+
+
+// a sigmoid net with the same structure as createchecknet and the same weights as net
+LayeredNet* copychecknet(LayeredNet *net)
+{
+  LayeredNet *copy = createchecknet(net->GetInputLayer()->neurons.GetSize(), net->GetOutputLayer()->neurons.GetSize());
+  copy->SetTransferFunctions(Neuron::SigmoidTransfer);
+
+  CompiledNet compiled;
+  compiled.Compile(net);
+  compiled.Store(copy);
+  return copy;
+}
+
+
+// TrainBatch on batches of a single sample must train like Train
+bool checktrainbatch()
+{
+  const int INPUTS = 3, OUTPUTS = 2;
+  LayeredNet *net = createchecknet(INPUTS, OUTPUTS);
+  net->SetTransferFunctions(Neuron::SigmoidTransfer);
+  LayeredNet *copy = copychecknet(net);
+  LayeredNet *untrained = copychecknet(net);
+
+  BPTrainer trainer(INPUTS, OUTPUTS), batchtrainer(INPUTS, OUTPUTS);
+  trainer.Step() = batchtrainer.Step() = 0.5;
+
+  double inputs[INPUTS], targets[OUTPUTS], outputs[OUTPUTS], batchoutputs[OUTPUTS], difference = 0;
+  for(int i = 0; i < 20; i ++) {
+    for(int j = 0; j < INPUTS; j ++)
+      inputs[j] = Random::GetDouble();
+    for(int j = 0; j < OUTPUTS; j ++)
+      targets[j] = Random::GetDouble();
+
+    trainer.Train(net, inputs, targets);
+    batchtrainer.TrainBatch(copy, inputs, targets, 1);
+  }
+
+  bool passed = batchtrainer.StoreWeights(copy);
+  passed = passed && net->Update(inputs, outputs) && copy->Update(inputs, batchoutputs);
+  difference = maxdifference(outputs, batchoutputs, OUTPUTS);
+
+  // and the net must have been trained at all
+  passed = passed && untrained->Update(inputs, batchoutputs) && maxdifference(outputs, batchoutputs, OUTPUTS) > 1e-3;
+
+  delete net;
+  delete copy;
+  delete untrained;
+  return report("train batch", passed && difference < 1e-12, difference);
+}
+
+
+// fills n samples of a smooth function with inputs between 0 and 1
+void createchecksamples(double *inputs, int inputcount, double *targets, int targetcount, int n)
+{
+  for(int i = 0; i < n; i ++) {
+    double sum = 0;
+    for(int j = 0; j < inputcount; j ++) {
+      inputs[i * inputcount + j] = Random::GetDouble();
+      sum += inputs[i * inputcount + j] * (j + 1);
+    }
+    for(int j = 0; j < targetcount; j ++)
+      targets[i * targetcount + j] = 0.5 + 0.4 * sin(sum + j);
+  }
+}
+
+
+// trains a sigmoid copy of net with the trainer on n samples in batches of 16, epochs times,
+// puts the outputs of the trained copy for the first sample into outputs
+// and returns the mean error of the last epoch
+double trainchecknet(BPTrainer *trainer, LayeredNet *net, const double *inputs, const double *targets,
+                     int n, int epochs, double *outputs)
+{
+  int inputcount = net->GetInputLayer()->neurons.GetSize(), outputcount = net->GetOutputLayer()->neurons.GetSize();
+  LayeredNet *copy = copychecknet(net);
+  double error = 0;
+
+  for(int e = 0; e < epochs; e ++) {
+    error = 0;
+    for(int i = 0; i < n; i += 16)
+      error += trainer->TrainBatch(copy, inputs + i * inputcount, targets + i * outputcount, min(16, n - i));
+    error /= (n + 15) / 16;
+  }
+
+  trainer->StoreWeights(copy);
+  copy->Update(inputs, outputs);
+  delete copy;
+  return error;
+}
+
+
+// the threads of a pool must train like a single thread, up to the order in which
+// the gradients are added up, and asynchronously they must still train
+bool checkthreads()
+{
+  const int n = 64, INPUTS = 5, OUTPUTS = 2;
+  LayeredNet *net = createchecknet(INPUTS, OUTPUTS);
+  double inputs[n * INPUTS], targets[n * OUTPUTS], outputs[OUTPUTS], threadoutputs[OUTPUTS];
+  createchecksamples(inputs, INPUTS, targets, OUTPUTS, n);
+
+  ThreadPool pool(4);
+  BPTrainer trainer(INPUTS, OUTPUTS), threadtrainer(INPUTS, OUTPUTS), hogwildtrainer(INPUTS, OUTPUTS);
+  trainer.Step() = threadtrainer.Step() = hogwildtrainer.Step() = 2;
+  threadtrainer.SetThreadPool(&pool);
+  hogwildtrainer.SetThreadPool(&pool, true);
+
+  double firsterror = trainchecknet(&trainer, net, inputs, targets, n, 1, outputs);
+  trainchecknet(&trainer, net, inputs, targets, n, 50, outputs);
+  trainchecknet(&threadtrainer, net, inputs, targets, n, 50, threadoutputs);
+  double difference = maxdifference(outputs, threadoutputs, OUTPUTS);
+  double hogwilderror = trainchecknet(&hogwildtrainer, net, inputs, targets, n, 50, threadoutputs);
+
+  delete net;
+  return report("threads", difference < 1e-10 && hogwilderror < firsterror, difference);
+}
+
+
+// every optimizer must train, and with a pool of threads it must train like
+// on a single thread, even in asynchronous mode, which an optimizer turns off
+bool checkoptimizers()
+{
+  const int n = 64, INPUTS = 5, OUTPUTS = 2;
+  LayeredNet *net = createchecknet(INPUTS, OUTPUTS);
+  double inputs[n * INPUTS], targets[n * OUTPUTS], outputs[OUTPUTS], threadoutputs[OUTPUTS];
+  createchecksamples(inputs, INPUTS, targets, OUTPUTS, n);
+
+  MomentumOptimizer momentum, threadmomentum;
+  RMSPropOptimizer rmsprop, threadrmsprop;
+  AdamOptimizer adam, threadadam;
+  Optimizer *optimizers[3] = { &momentum, &rmsprop, &adam };
+  Optimizer *threadoptimizers[3] = { &threadmomentum, &threadrmsprop, &threadadam };
+  double steps[3] = { 0.5, 0.01, 0.01 };
+
+  ThreadPool pool(4);
+  BPTrainer trainer(INPUTS, OUTPUTS), threadtrainer(INPUTS, OUTPUTS);
+  threadtrainer.SetThreadPool(&pool, true);
+
+  bool passed = true;
+  double difference = 0;
+
+  for(int i = 0; i < 3; i ++) {
+    trainer.Step() = threadtrainer.Step() = steps[i];
+
+    trainer.SetOptimizer(null);
+    double firsterror = trainchecknet(&trainer, net, inputs, targets, n, 1, outputs);
+
+    trainer.SetOptimizer(optimizers[i]);
+    threadtrainer.SetOptimizer(threadoptimizers[i]);
+    double error = trainchecknet(&trainer, net, inputs, targets, n, 30, outputs);
+    trainchecknet(&threadtrainer, net, inputs, targets, n, 30, threadoutputs);
+
+    difference = fmax(difference, maxdifference(outputs, threadoutputs, OUTPUTS));
+    passed = passed && error < firsterror;
+  }
+
+  delete net;
+  return report("optimizers", passed && difference < 1e-10, difference);
+}
+
+
+//*******************************************
+// datasets
+
+// a dataset saved to a file of doubles must come back unchanged
+// and one of floats must come back to float precision
+bool checkdatasets()
+{
+  const int SIZE = 50, INPUTS = 5, TARGETS = 2;
+  double inputs[SIZE * INPUTS], targets[SIZE * TARGETS];
+  for(int i = 0; i < SIZE * INPUTS; i ++)
+    inputs[i] = Random::GetDouble(-10, 10);
+  for(int i = 0; i < SIZE * TARGETS; i ++)
+    targets[i] = Random::GetDouble();
+
+  MemoryDataset memory(inputs, targets, SIZE, INPUTS, TARGETS);
+  bool passed = true;
+  double difference = 0, floatdifference = 0;
+
+  for(int type = FileDataset::Double; type <= FileDataset::Float; type ++) {
+    FileDataset file;
+    passed = passed && FileDataset::Save("check.ds", &memory, type) && file.Open("check.ds");
+    passed = passed && file.GetSize() == SIZE && file.GetInputCount() == INPUTS && file.GetTargetCount() == TARGETS;
+    if(!passed) break;
+
+    double &result = type == FileDataset::Double ? difference : floatdifference;
+    for(int i = 0; i < SIZE; i ++) {
+      result = fmax(result, maxdifference(file.GetInput(i), memory.GetInput(i), INPUTS));
+      result = fmax(result, maxdifference(file.GetTarget(i), memory.GetTarget(i), TARGETS));
+    }
+
+    // a shuffled batch must be gathered from the right rows
+    int indices[3] = { 41, 7, 23 };
+    double batchinputs[3 * INPUTS], batchtargets[3 * TARGETS];
+    file.GetBatch(indices, 3, batchinputs, batchtargets);
+    for(int i = 0; i < 3; i ++) {
+      result = fmax(result, maxdifference(batchinputs + i * INPUTS, memory.GetInput(indices[i]), INPUTS));
+      result = fmax(result, maxdifference(batchtargets + i * TARGETS, memory.GetTarget(indices[i]), TARGETS));
+    }
+    file.Close();
+  }
+
+  remove("check.ds");
+  return report("datasets", passed && difference == 0 && floatdifference < 1e-5, difference);
+}
+
+
+// doubles the inputs of a batch, see checkprefetcher
+void preparecheckbatch(double *inputs, double *, int n, void *param)
+{
+  int inputcount = *(int *)param;
+  for(int i = 0; i < n * inputcount; i ++)
+    inputs[i] *= 2;
+}
+
+
+// a prefetcher must hand out every sample once per epoch, prepared, in batches
+// of the right size with the last one marked, and an epoch trained on its batches
+// in order must train like one trained on the dataset itself
+bool checkprefetcher()
+{
+  const int SIZE = 50, BATCH = 8, INPUTS = 3, TARGETS = 1;
+  double inputs[SIZE * INPUTS], targets[SIZE * TARGETS];
+  for(int i = 0; i < SIZE; i ++) {
+    for(int j = 0; j < INPUTS; j ++)
+      inputs[i * INPUTS + j] = i * 10 + j;
+    targets[i] = i;
+  }
+
+  MemoryDataset dataset(inputs, targets, SIZE, INPUTS, TARGETS);
+  Prefetcher prefetcher;
+  int inputcount = INPUTS;
+  prefetcher.SetPrepareFunction(preparecheckbatch, &inputcount);
+  bool passed = prefetcher.Start(&dataset, BATCH, 3);
+
+  for(int epoch = 0; epoch < 2 && passed; epoch ++) {
+    int seen[SIZE], count = 0;
+    memset(seen, 0, sizeof(seen));
+
+    Prefetcher::Batch *batch;
+    do {
+      batch = prefetcher.Next();
+      if(batch == null) return report("prefetcher", false, 0);
+
+      passed = passed && batch->epoch == epoch && batch->n == min(BATCH, SIZE - count);
+      for(int r = 0; r < batch->n; r ++) {
+        int sample = (int)batch->targets[r];
+        seen[sample] ++;
+        for(int j = 0; j < INPUTS; j ++)
+          passed = passed && batch->inputs[r * INPUTS + j] == 2 * inputs[sample * INPUTS + j];
+      }
+      count += batch->n;
+    } while(!batch->last);
+
+    for(int i = 0; i < SIZE; i ++)
+      passed = passed && seen[i] == 1;
+  }
+  prefetcher.Stop();
+  passed = passed && prefetcher.GetBatchCount() == 2 * ((SIZE + BATCH - 1) / BATCH);
+
+  // training on unshuffled batches without preparing them
+  LayeredNet *net = createchecknet(INPUTS, TARGETS);
+  createchecksamples(inputs, INPUTS, targets, TARGETS, SIZE);
+  MemoryDataset samples(inputs, targets, SIZE, INPUTS, TARGETS);
+  double outputs[TARGETS], prefetchoutputs[TARGETS];
+
+  LayeredNet *copy = copychecknet(net), *prefetchcopy = copychecknet(net);
+  BPTrainer trainer(INPUTS, TARGETS), prefetchtrainer(INPUTS, TARGETS);
+  trainer.Step() = prefetchtrainer.Step() = 2;
+  trainer.SetDataset(&samples);
+  prefetcher.SetPrepareFunction(null);
+  passed = passed && prefetcher.Start(&samples, BATCH, 3, false);
+  for(int epoch = 0; epoch < 3; epoch ++) {
+    trainer.TrainEpoch(copy, BATCH, false);
+    prefetchtrainer.TrainEpoch(prefetchcopy, &prefetcher);
+  }
+  prefetcher.Stop();
+
+  copy->Update(inputs, outputs);
+  prefetchcopy->Update(inputs, prefetchoutputs);
+  double difference = maxdifference(outputs, prefetchoutputs, TARGETS);
+
+  delete net;
+  delete copy;
+  delete prefetchcopy;
+  return report("prefetcher", passed && difference < 1e-12, difference);
+}
+
+
+//*******************************************
+// csv
+
+// numbers must be parsed like strtod does, the bad fields must be counted,
+// become 0 and be left out of the ranges the values are scaled with
+bool checkcsv()
+{
+  const char *numbers[] = { "0", "-1.5", " 42 ", "3.25e2", "1e-3", ".5", "-0.000125", "123456789012345" };
+  const char *bad[] = { "", "abc", "1.2.3", "--1", "1e" };
+  double value, difference = 0;
+  bool passed = true;
+
+  for(int i = 0; i < (int)(sizeof(numbers) / sizeof(numbers[0])); i ++) {
+    passed = passed && CsvConverter::ParseNumber(numbers[i], numbers[i] + strlen(numbers[i]), value);
+    difference = fmax(difference, fabs(value - strtod(numbers[i], null)));
+  }
+  for(int i = 0; i < (int)(sizeof(bad) / sizeof(bad[0])); i ++)
+    passed = passed && !CsvConverter::ParseNumber(bad[i], bad[i] + strlen(bad[i]), value);
+
+  FILE *file = fopen("check.csv", "wb");
+  if(file == null) return report("csv", false, 0);
+  fputs("a,b,c\n1,10,0\n2,abc,1\n3,30,0\n,20,1\n", file);
+  fclose(file);
+
+  // the rows scaled to the range from 0 to 1
+  double expected[] = { 0, 0, 0,  0.5, 0, 1,  1, 1, 0,  0, 0.5, 1 };
+
+  // on the calling thread and split into chunks on a pool
+  ThreadPool pool(3);
+  for(int threads = 0; threads < 2 && passed; threads ++) {
+    CsvConverter converter;
+    converter.Header() = true;
+    converter.SetThreadPool(threads == 0 ? null : &pool);
+    passed = passed && converter.Convert("check.csv", "check.ds");
+    passed = passed && converter.GetRowCount() == 4 && converter.GetErrorCount() == 2;
+    passed = passed && converter.GetMinimums()[0] == 1 && converter.GetMaximums()[0] == 3;
+    passed = passed && converter.GetMinimums()[1] == 10 && converter.GetMaximums()[1] == 30;
+
+    FileDataset dataset;
+    if(passed && dataset.Open("check.ds") && dataset.GetSize() == 4) {
+      for(int i = 0; i < 4; i ++) {
+        difference = fmax(difference, maxdifference(dataset.GetInput(i), expected + i * 3, 2));
+        difference = fmax(difference, maxdifference(dataset.GetTarget(i), expected + i * 3 + 2, 1));
+      }
+      dataset.Close();
+    } else
+      passed = false;
+  }
+
+  remove("check.csv");
+  remove("check.ds");
+  return report("csv", passed && difference < 1e-12, difference);
+}
+
+
+//*******************************************
+// evaluation
+
+// the errors and the accuracy measured by an Evaluator must be the ones of
+// a loop over Update, on one thread, on a pool and in the background, where
+// the net may be changed once the evaluation has started
+bool checkevaluator()
+{
+  const int SIZE = 600, INPUTS = 4, OUTPUTS = 3;
+  LayeredNet *net = createchecknet(INPUTS, OUTPUTS);
+  double *inputs = new double[SIZE * INPUTS], *targets = new double[SIZE * OUTPUTS];
+  createchecksamples(inputs, INPUTS, targets, OUTPUTS, SIZE);
+  MemoryDataset dataset(inputs, targets, SIZE, INPUTS, OUTPUTS);
+
+  // the evaluation by hand
+  double error = 0, squarederror = 0, outputs[OUTPUTS];
+  int correct = 0;
+  for(int i = 0; i < SIZE; i ++) {
+    const double *target = targets + i * OUTPUTS;
+    net->Update(inputs + i * INPUTS, outputs);
+
+    int largest = 0, largesttarget = 0;
+    for(int j = 0; j < OUTPUTS; j ++) {
+      error += fabs(target[j] - outputs[j]);
+      squarederror += (target[j] - outputs[j]) * (target[j] - outputs[j]);
+      if(outputs[j] > outputs[largest]) largest = j;
+      if(target[j] > target[largesttarget]) largesttarget = j;
+    }
+    correct += largest == largesttarget;
+  }
+  error /= SIZE * OUTPUTS;
+  squarederror /= SIZE * OUTPUTS;
+
+  ThreadPool pool(4), backgroundpool(2);
+  Evaluator evaluator;
+  Evaluation results[4];
+  bool passed = evaluator.Evaluate(net, &dataset, results[0]);
+  evaluator.SetThreadPool(&pool);
+  passed = passed && evaluator.Evaluate(net, &dataset, results[1]);
+
+  // the background evaluation works on a snapshot of the weights
+  CompiledNet compiled;
+  compiled.Compile(net);
+  for(int i = 2; i < 4 && passed; i ++) {
+    evaluator.SetBackgroundThreadPool(i == 2 ? null : &backgroundpool);
+    passed = evaluator.Start(net, &dataset);
+    net->SetWeights(Neuron::RandomWeights);
+    passed = evaluator.Wait(results[i]) && passed;
+    compiled.Store(net);
+  }
+
+  double difference = 0;
+  for(int i = 0; i < 4; i ++) {
+    difference = fmax(difference, fabs(results[i].meanerror - error));
+    difference = fmax(difference, fabs(results[i].squarederror - squarederror));
+    passed = passed && results[i].count == SIZE && results[i].accuracy == correct / (double)SIZE;
+  }
+
+  delete net;
+  delete[] inputs;
+  delete[] targets;
+  return report("evaluator", passed && difference < 1e-12, difference);
+}
+
+
+//*******************************************
+// genetic algorithms
+
+// the rows of a population must be aligned and keep their genes when it grows,
+// a mutation must change about rate of the genes by at most the offset and leave
+// the padding alone, and a cross over must swap the genes after a single point
+bool checkpopulation()
+{
+  const int SIZE = 40, GENES = 13;
+  Population population;
+  bool passed = true;
+
+  for(int i = 0; i < SIZE; i ++) {
+    double *genes = population.GetGenes(population.Add(GENES));
+    for(int g = 0; g < GENES; g ++)
+      genes[g] = i * GENES + g;
+  }
+
+  double before[SIZE * GENES];
+  for(int i = 0; i < SIZE; i ++) {
+    const double *genes = population.GetGenes(i);
+    passed = passed && ((size_t)genes & 63) == 0;
+    for(int g = 0; g < population.GetStride(); g ++)
+      passed = passed && genes[g] == (g < GENES ? i * GENES + g : 0);
+    memcpy(before + i * GENES, genes, GENES * sizeof(double));
+  }
+
+  // about a tenth of the genes mutate
+  int mutated = 0;
+  double difference = 0;
+  population.Mutate(0.1, 0.5);
+  for(int i = 0; i < SIZE; i ++) {
+    const double *genes = population.GetGenes(i);
+    for(int g = 0; g < GENES; g ++) {
+      difference = fmax(difference, fabs(genes[g] - before[i * GENES + g]));
+      mutated += genes[g] != before[i * GENES + g];
+    }
+    for(int g = GENES; g < population.GetStride(); g ++)
+      passed = passed && genes[g] == 0;
+    memcpy(before + i * GENES, genes, GENES * sizeof(double));
+  }
+  passed = passed && difference <= 0.5 && mutated > SIZE * GENES / 20 && mutated < SIZE * GENES / 5;
+
+  // the second half is the first one crossed over
+  for(int i = 0; i < SIZE / 2; i += 2) {
+    population.CrossOver(i, i + 1, i, i + 1, 0);
+    population.CrossOver(i, i + 1, SIZE / 2 + i, SIZE / 2 + i + 1, 1);
+  }
+  population.Swap();
+
+  for(int i = 0; i < SIZE / 2; i += 2) {
+    const double *a = before + i * GENES, *b = a + GENES;
+    const double *newa = population.GetGenes(SIZE / 2 + i), *newb = population.GetGenes(SIZE / 2 + i + 1);
+    passed = passed && memcmp(population.GetGenes(i), a, GENES * sizeof(double)) == 0;
+    passed = passed && memcmp(population.GetGenes(i + 1), b, GENES * sizeof(double)) == 0;
+
+    int flippoint = 0;
+    while(flippoint < GENES && newa[flippoint] == a[flippoint]) flippoint ++;
+    for(int g = 0; g < GENES; g ++)
+      passed = passed && newa[g] == (g < flippoint ? a[g] : b[g]) && newb[g] == (g < flippoint ? b[g] : a[g]);
+  }
+
+  return report("population", passed, difference);
+}
+
+
+// each index must be drawn about as often as its share of the weights
+// and with weights that are all 0 each index must have the same chance
+bool checkwheel()
+{
+  const int SIZE = 6, DRAWS = 600000;
+  double weights[SIZE] = { 0, 1, 2, 0.5, 4, 0.5 }, total = 8;
+  int counts[SIZE];
+  RouletteWheel wheel;
+  double difference = 0;
+
+  wheel.Build(weights, SIZE);
+  memset(counts, 0, sizeof(counts));
+  for(int i = 0; i < DRAWS; i ++)
+    counts[wheel.Draw()] ++;
+  for(int i = 0; i < SIZE; i ++)
+    difference = fmax(difference, fabs(counts[i] / (double)DRAWS - weights[i] / total));
+  bool passed = counts[0] == 0;
+
+  memset(weights, 0, sizeof(weights));
+  wheel.Build(weights, SIZE);
+  memset(counts, 0, sizeof(counts));
+  for(int i = 0; i < DRAWS; i ++)
+    counts[wheel.Draw()] ++;
+  for(int i = 0; i < SIZE; i ++)
+    difference = fmax(difference, fabs(counts[i] / (double)DRAWS - 1.0 / SIZE));
+
+  return report("roulette wheel", passed && difference < 0.01, difference);
+}
+
+
+// the mean error of the nets over n samples from state on, which wrap around at the end
+double meanchecknets(Container *nets, Dataset *dataset, int state, int n)
+{
+  int outputcount = dataset->GetTargetCount();
+  double outputs[16], error = 0;
+
+  forEach(LayeredNet, (*nets), net) {
+    double neterror = 0;
+    for(int r = 0; r < n; r ++) {
+      int sample = (state + r) % dataset->GetSize();
+      net->Update(dataset->GetInput(sample), outputs);
+      for(int j = 0; j < outputcount; j ++)
+        neterror += fabs(dataset->GetTarget(sample)[j] - outputs[j]);
+    }
+    error += neterror / (n * outputcount);
+  }
+  return error / nets->GetSize();
+}
+
+
+// the compiled nets must evaluate the population on all the samples at once with
+// the errors of the nets updated one sample at a time, on one thread and on a pool
+bool checkgaerrors()
+{
+  const int SIZE = 50, INPUTS = 4, OUTPUTS = 3, NETS = 10, SAMPLES = 16;
+  double inputs[SIZE * INPUTS], targets[SIZE * OUTPUTS];
+  createchecksamples(inputs, INPUTS, targets, OUTPUTS, SIZE);
+  MemoryDataset dataset(inputs, targets, SIZE, INPUTS, OUTPUTS);
+
+  GATrainer trainer(INPUTS, OUTPUTS);
+  trainer.SampleCount() = SAMPLES;
+  trainer.SetDataset(&dataset);
+  for(int i = 0; i < NETS; i ++)
+    trainer.AddNet(createchecknet(INPUTS, OUTPUTS));
+
+  ThreadPool pool(3);
+  double difference = 0;
+  for(int g = 0; g < 4; g ++) {
+    trainer.SetThreadPool(g % 2 == 0 ? null : &pool);
+    double error = meanchecknets(trainer.GetNets(), &dataset, g * 20, SAMPLES);
+    difference = fmax(difference, fabs(trainer.Train(g * 20) - error));
+  }
+
+  trainer.RemoveNets();
+  return report("genetic algorithm errors", difference < 1e-12, difference);
+}
+
+
+// the chromosomes of a population of compiled nets must be the weights of the compiled nets,
+// so a compiled net bound to one has the outputs of its net, and a BPTrainer bound to one
+// must train it like the net itself
+bool checkgabind()
+{
+  const int SIZE = 32, INPUTS = 4, OUTPUTS = 2, NETS = 6;
+  double inputs[SIZE * INPUTS], targets[SIZE * OUTPUTS], outputs[OUTPUTS], boundoutputs[OUTPUTS];
+  createchecksamples(inputs, INPUTS, targets, OUTPUTS, SIZE);
+  MemoryDataset dataset(inputs, targets, SIZE, INPUTS, OUTPUTS);
+
+  GATrainer trainer(INPUTS, OUTPUTS);
+  trainer.SampleCount() = 8;
+  trainer.SetDataset(&dataset);
+  for(int i = 0; i < NETS; i ++)
+    trainer.AddNet(createchecknet(INPUTS, OUTPUTS));
+  for(int g = 0; g < 3; g ++)
+    trainer.Train(g * 8);
+  bool passed = trainer.IsBound();
+
+  CompiledNet compiled;
+  LayeredNet *first = (LayeredNet *)trainer.GetNets()->Get(0);
+  passed = passed && compiled.Compile(first);
+
+  double difference = 0;
+  int i = 0;
+  forEach(LayeredNet, (*trainer.GetNets()), net) {
+    compiled.Bind(trainer.GetPopulation()->GetGenes(i ++));
+    net->Update(inputs, outputs);
+    passed = passed && compiled.Update(inputs, boundoutputs);
+    difference = fmax(difference, maxdifference(outputs, boundoutputs, OUTPUTS));
+  }
+
+  // the first chromosome trained in place and a copy of its net trained on its own
+  LayeredNet *copy = createchecknet(INPUTS, OUTPUTS);
+  compiled.Compile(first);
+  compiled.Store(copy);
+
+  BPTrainer bpt(INPUTS, OUTPUTS), boundbpt(INPUTS, OUTPUTS);
+  bpt.Step() = boundbpt.Step() = 2;
+  boundbpt.Bind(trainer.GetPopulation()->GetGenes(0));
+  for(int e = 0; e < 5; e ++) {
+    for(int b = 0; b < SIZE; b += 8) {
+      bpt.TrainBatch(copy, inputs + b * INPUTS, targets + b * OUTPUTS, 8);
+      boundbpt.TrainBatch(first, inputs + b * INPUTS, targets + b * OUTPUTS, 8);
+    }
+  }
+  bpt.StoreWeights(copy);
+  passed = passed && boundbpt.StoreWeights(first);
+
+  copy->Update(inputs, outputs);
+  first->Update(inputs, boundoutputs);
+  difference = fmax(difference, maxdifference(outputs, boundoutputs, OUTPUTS));
+
+  compiled.Bind(trainer.GetPopulation()->GetGenes(0));
+  passed = passed && compiled.Update(inputs, boundoutputs);
+  difference = fmax(difference, maxdifference(outputs, boundoutputs, OUTPUTS));
+
+  delete copy;
+  trainer.RemoveNets();
+  return report("genetic algorithm bind", passed && difference < 1e-12, difference);
+}
+
+
+// evolves a population of count nets from the same seed for generations generations,
+// on samples of the dataset, puts the error of each generation into errors
+// and the outputs of the first net for the first sample into outputs
+void evolvechecknets(ThreadPool *pool, Dataset *dataset, int count, int generations,
+                     double *errors, double *outputs)
+{
+  int inputcount = dataset->GetInputCount(), outputcount = dataset->GetTargetCount();
+  GATrainer trainer(inputcount, outputcount);
+  trainer.MutationRate() = 0.1;
+  trainer.MutationOffset() = 0.3;
+  trainer.CrossOverRate() = 0.7;
+  trainer.SampleCount() = 16;
+  trainer.SetDataset(dataset);
+  trainer.SetThreadPool(pool);
+
+  Random::Seed(7);
+  for(int i = 0; i < count; i ++)
+    trainer.AddNet(createchecknet(inputcount, outputcount));
+  for(int g = 0; g < generations; g ++)
+    errors[g] = trainer.Train(g * 16);
+
+  ((LayeredNet *)trainer.GetNets()->Get(0))->Update(dataset->GetInput(0), outputs);
+  trainer.RemoveNets();
+}
+
+
+// the population must evolve in the same way on a pool as on a single thread
+bool checkga()
+{
+  const int SIZE = 100, INPUTS = 4, OUTPUTS = 2, NETS = 30, GENERATIONS = 20;
+  double inputs[SIZE * INPUTS], targets[SIZE * OUTPUTS];
+  createchecksamples(inputs, INPUTS, targets, OUTPUTS, SIZE);
+  MemoryDataset dataset(inputs, targets, SIZE, INPUTS, OUTPUTS);
+
+  double errors[GENERATIONS], poolerrors[GENERATIONS], outputs[OUTPUTS], pooloutputs[OUTPUTS];
+  ThreadPool pool(4);
+  evolvechecknets(null, &dataset, NETS, GENERATIONS, errors, outputs);
+  evolvechecknets(&pool, &dataset, NETS, GENERATIONS, poolerrors, pooloutputs);
+
+  double difference = fmax(maxdifference(errors, poolerrors, GENERATIONS), maxdifference(outputs, pooloutputs, OUTPUTS));
+  return report("genetic algorithm threads", difference == 0, difference);
+}
+
+//*******************************************
+
+// runs all the checks, returns false if any of them failed
+bool runchecks()
+{
+  // the same random nets and samples every time
+  Random::Seed(1);
+  bool passed = true;
+
+  passed = checkcompiled() && passed;
+  passed = checkbatch() && passed;
+  passed = checkfloat() && passed;
+  passed = checksaveload() && passed;
+  passed = checkquantized() && passed;
+  passed = checkgradients() && passed;
+  passed = checktrainbatch() && passed;
+  passed = checkthreads() && passed;
+  passed = checkoptimizers() && passed;
+  passed = checkdatasets() && passed;
+  passed = checkprefetcher() && passed;
+  passed = checkcsv() && passed;
+  passed = checkevaluator() && passed;
+  passed = checkpopulation() && passed;
+  passed = checkwheel() && passed;
+  passed = checkgaerrors() && passed;
+  passed = checkga() && passed;
+  passed = checkgabind() && passed;
+
+  return passed;
+}
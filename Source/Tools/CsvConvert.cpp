@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../CsvConverter.h"
+
+// converts a text file of comma separated values into a dataset file
+// which can be opened by FileDataset, see CsvConverter
+
+void usage()
+{
+  printf("usage: CsvConvert [options] input.csv output.dataset\n");
+  printf("  -i columns  the input columns, like 0-5,7, counting from 0\n");
+  printf("  -t columns  the target columns, by default the last column is the target\n");
+  printf("              and all the others are inputs\n");
+  printf("  -H          skip the first line, which holds the names of the columns\n");
+  printf("  -d char     the separator between the fields, a comma by default\n");
+  printf("  -n          don't scale the values to the range from 0 to 1\n");
+  printf("  -f          store floats instead of doubles\n");
+  printf("  -j threads  the number of threads, one for each processor by default\n");
+}
+
+// parses a list of columns and ranges of columns like 0-5,7
+// returns the number of columns or -1 if the list isn't valid
+int parsecolumns(const char *text, int *columns, int size)
+{
+  int count = 0;
+  while(*text != 0) {
+    char *end;
+    int first = strtol(text, &end, 10), last = first;
+    if(end == text || first < 0) return -1;
+
+    text = end;
+    if(*text == '-') {
+      last = strtol(text + 1, &end, 10);
+      if(end == text + 1 || last < first) return -1;
+      text = end;
+    }
+
+    for(int i = first; i <= last; i ++) {
+      if(count == size) return -1;
+      columns[count ++] = i;
+    }
+
+    if(*text == ',') text ++;
+    else if(*text != 0) return -1;
+  }
+  return count;
+}
+
+int main(int argc, char **argv)
+{
+  const int MaxColumns = 4096;
+  static int inputs[MaxColumns], targets[MaxColumns];
+  int inputcount = 0, targetcount = 0, threadcount = 0;
+  int type = FileDataset::Double;
+  const char *files[2];
+  int filecount = 0;
+
+  CsvConverter converter;
+
+  for(int i = 1; i < argc; i ++) {
+    const char *arg = argv[i];
+    bool value = i + 1 < argc;
+
+    if(strcmp(arg, "-i") == 0 && value)
+      inputcount = parsecolumns(argv[++ i], inputs, MaxColumns);
+    else if(strcmp(arg, "-t") == 0 && value)
+      targetcount = parsecolumns(argv[++ i], targets, MaxColumns);
+    else if(strcmp(arg, "-H") == 0)
+      converter.Header() = true;
+    else if(strcmp(arg, "-d") == 0 && value)
+      converter.Separator() = argv[++ i][0];
+    else if(strcmp(arg, "-n") == 0)
+      converter.Scale() = false;
+    else if(strcmp(arg, "-f") == 0)
+      type = FileDataset::Float;
+    else if(strcmp(arg, "-j") == 0 && value)
+      threadcount = atoi(argv[++ i]);
+    else if(arg[0] != '-' && filecount < 2)
+      files[filecount ++] = arg;
+    else {
+      usage();
+      return 1;
+    }
+  }
+
+  if(filecount != 2 || inputcount < 0 || targetcount < 0 || (inputcount == 0) != (targetcount == 0)) {
+    usage();
+    return 1;
+  }
+
+  if(inputcount > 0)
+    converter.SetColumns(inputs, inputcount, targets, targetcount);
+
+  ThreadPool pool(threadcount);
+  converter.SetThreadPool(&pool);
+
+  double start = Clock::GetSeconds();
+  if(!converter.Convert(files[0], files[1], type)) {
+    printf("couldn't convert %s to %s\n", files[0], files[1]);
+    return 1;
+  }
+  double seconds = Clock::GetSeconds() - start;
+
+  printf("%d samples, %d missing or bad fields, %.2f seconds on %d threads\n",
+    converter.GetRowCount(), converter.GetErrorCount(), seconds, pool.GetThreadCount());
+  return 0;
+}
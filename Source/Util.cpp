@@ -1,3 +1,14 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include "Util.h"
 #include <stdlib.h>
 #include <memory.h>
@@ -23,7 +34,7 @@ void Element::Free()
 
 //*** Container
 
-Container::Container() : elements(null), size(0) 
+Container::Container() : elements(null), size(0), version(0) 
 {
 }
 
@@ -39,17 +50,14 @@ Element* Container::Elements()
 
 bool Container::Find(const Element *element) 
 {
-	Element *c = elements;
-	while(c != null) { 
-		if(c == element) return true;  
-		c = c->next; 
-	}
-
-	return false;
+  // an element can only be in one container at a time
+	return element != null && element->container == this;
 }
 
 int Container::GetIndex(const Element *element) 
 {
+  if(!Find(element)) return -1;
+
 	Element *c = elements;
   int i = 0;
 	while(c != null) { 
@@ -75,6 +83,7 @@ bool Container::Attach(Element *element)
 		element->container = this;
 		
     size ++;
+    version ++;
 		return true;
 	}
 
@@ -106,6 +115,7 @@ bool Container::AttachLast(Element *element)
 		}
 
     size ++;
+    version ++;
 		return true;
 	}
 
@@ -129,6 +139,7 @@ bool Container::AttachAfter(Element *element, Element *after)
 		element->container = this;
 
     size ++;
+    version ++;
 		return true;
 	}
 
@@ -155,6 +166,7 @@ bool Container::AttachBefore(Element *element, Element *before)
 		element->container = this;
 
     size ++;
+    version ++;
 		return true;
 	}
 
@@ -182,6 +194,7 @@ bool Container::AttachAt(Element *element, int index)
 		  element->container = this;
 
       size ++;
+      version ++;
 		  return true;
     }
   }
@@ -203,6 +216,7 @@ bool Container::Detach(Element *element)
 		element->container = null;
 
     size --;
+    version ++;
 		return true;
 	}
 
@@ -216,6 +230,14 @@ void Container::DetachAll()
 }
 
 
+void Container::Abandon()
+{
+  elements = null;
+  size = 0;
+  version ++;
+}
+
+
 void Container::Empty() 
 { 
 	while(elements != null) delete elements; 
@@ -260,9 +282,86 @@ CleanContainer::~CleanContainer()
 }
 
 
+//*** IndexedContainer
+
+IndexedContainer::IndexedContainer() : index(null), table(null), capacity(0), tablesize(0), indexversion(-1)
+{
+}
+
+IndexedContainer::~IndexedContainer()
+{
+  safe_delete_array(index);
+  safe_delete_array(table);
+}
+
+int IndexedContainer::Hash(const Element *element)
+{
+  // the low bits of a pointer are always the same because of alignment
+  size_t h = (size_t)element >> 3;
+  return (int)((unsigned int)h * 2654435761u) & (tablesize - 1);
+}
+
+void IndexedContainer::UpdateIndex()
+{
+  if(indexversion == version) return;
+
+  if(size > capacity) {
+    safe_delete_array(index);
+    safe_delete_array(table);
+
+    capacity = max(size, capacity * 2);
+    index = new Element*[capacity];
+
+    // the hash table is kept at most half full
+    for(tablesize = 16; tablesize < capacity * 2; tablesize *= 2);
+    table = new int[tablesize];
+  }
+
+  for(int i = 0; i < tablesize; i ++)
+    table[i] = -1;
+
+  int i = 0;
+  for(Element *c = elements; c != null; c = c->Next(), i ++) {
+    index[i] = c;
+
+    int h = Hash(c);
+    while(table[h] != -1) h = (h + 1) & (tablesize - 1);
+    table[h] = i;
+  }
+
+  indexversion = version;
+}
+
+Element* IndexedContainer::Get(int number)
+{
+  if(number < 0 || number >= size) return null;
+
+  UpdateIndex();
+  return index[number];
+}
+
+int IndexedContainer::GetIndex(const Element *element)
+{
+  if(!Find(element)) return -1;
+
+  UpdateIndex();
+  int h = Hash(element);
+  while(index[table[h]] != element) h = (h + 1) & (tablesize - 1);
+  return table[h];
+}
+
+
+//*** IndexedCleanContainer
+
+IndexedCleanContainer::~IndexedCleanContainer() 
+{
+	Empty();
+}
+
+
 //*** MemoryBuffer
 
-int MemoryBuffer::GetSize() 
+size_t MemoryBuffer::GetSize() 
 { 
   return size; 
 }
@@ -273,19 +372,19 @@ void* MemoryBuffer::GetBuffer()
 }
 
 // expands the buffer if necessary and returns the pointer to the bytes
-void* MemoryBuffer::GetBuffer(int bytesize) 
+void* MemoryBuffer::GetBuffer(size_t bytesize) 
 {
   if(bytesize > size) {
-    safe_delete(buffer);
+    safe_delete_array(buffer);
     size = bytesize;
     buffer = new unsigned char[size];
   }
   return buffer;
 }
 
-void* MemoryBuffer::Realloc(int bytesize) 
+void* MemoryBuffer::Realloc(size_t bytesize) 
 {
-  int copysize = min(bytesize,size);
+  size_t copysize = min(bytesize,size);
   unsigned char *newbuffer = new unsigned char[bytesize];
   memcpy(newbuffer, buffer, copysize);
   safe_delete_array(buffer);
@@ -304,7 +403,7 @@ MemoryBuffer::MemoryBuffer() : buffer(null), size(0)
 {
 }
 
-MemoryBuffer::MemoryBuffer(int bytesize) 
+MemoryBuffer::MemoryBuffer(size_t bytesize) 
 {
   size = bytesize;
   buffer = new unsigned char[size];
@@ -335,6 +434,433 @@ int Random::GetInt(int min, int max)
   return rand() % (max - min) + min;
 }
 
+//*** Mutex, Condition and Thread
+
+#ifdef _WIN32
+
+Mutex::Mutex()
+{
+  handle = new CRITICAL_SECTION;
+  InitializeCriticalSection((CRITICAL_SECTION *)handle);
+}
+
+Mutex::~Mutex()
+{
+  DeleteCriticalSection((CRITICAL_SECTION *)handle);
+  delete (CRITICAL_SECTION *)handle;
+}
+
+void Mutex::Lock()
+{
+  EnterCriticalSection((CRITICAL_SECTION *)handle);
+}
+
+void Mutex::Unlock()
+{
+  LeaveCriticalSection((CRITICAL_SECTION *)handle);
+}
+
+Condition::Condition()
+{
+  handle = new CONDITION_VARIABLE;
+  InitializeConditionVariable((CONDITION_VARIABLE *)handle);
+}
+
+Condition::~Condition()
+{
+  delete (CONDITION_VARIABLE *)handle;
+}
+
+void Condition::Wait(Mutex *mutex)
+{
+  SleepConditionVariableCS((CONDITION_VARIABLE *)handle, (CRITICAL_SECTION *)mutex->handle, INFINITE);
+}
+
+void Condition::Signal()
+{
+  WakeConditionVariable((CONDITION_VARIABLE *)handle);
+}
+
+void Condition::Broadcast()
+{
+  WakeAllConditionVariable((CONDITION_VARIABLE *)handle);
+}
+
+struct ThreadStart
+{
+  static DWORD WINAPI Run(LPVOID thread) { Thread::Run((Thread *)thread); return 0; }
+};
 
+bool Thread::Start(THREADFUNCTION f, void *p)
+{
+  if(handle != null) return false;
 
+  function = f;
+  param = p;
+  handle = CreateThread(null, 0, ThreadStart::Run, this, 0, null);
+  return handle != null;
+}
+
+void Thread::Join()
+{
+  if(handle == null) return;
+
+  WaitForSingleObject((HANDLE)handle, INFINITE);
+  CloseHandle((HANDLE)handle);
+  handle = null;
+}
+
+int Thread::GetProcessorCount()
+{
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return max(1, (int)info.dwNumberOfProcessors);
+}
+
+double Clock::GetSeconds()
+{
+  LARGE_INTEGER count, frequency;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&frequency);
+  return (double)count.QuadPart / (double)frequency.QuadPart;
+}
+
+#else
+
+Mutex::Mutex()
+{
+  handle = new pthread_mutex_t;
+  pthread_mutex_init((pthread_mutex_t *)handle, null);
+}
+
+Mutex::~Mutex()
+{
+  pthread_mutex_destroy((pthread_mutex_t *)handle);
+  delete (pthread_mutex_t *)handle;
+}
+
+void Mutex::Lock()
+{
+  pthread_mutex_lock((pthread_mutex_t *)handle);
+}
+
+void Mutex::Unlock()
+{
+  pthread_mutex_unlock((pthread_mutex_t *)handle);
+}
+
+Condition::Condition()
+{
+  handle = new pthread_cond_t;
+  pthread_cond_init((pthread_cond_t *)handle, null);
+}
+
+Condition::~Condition()
+{
+  pthread_cond_destroy((pthread_cond_t *)handle);
+  delete (pthread_cond_t *)handle;
+}
+
+void Condition::Wait(Mutex *mutex)
+{
+  pthread_cond_wait((pthread_cond_t *)handle, (pthread_mutex_t *)mutex->handle);
+}
+
+void Condition::Signal()
+{
+  pthread_cond_signal((pthread_cond_t *)handle);
+}
+
+void Condition::Broadcast()
+{
+  pthread_cond_broadcast((pthread_cond_t *)handle);
+}
+
+struct ThreadStart
+{
+  static void* Run(void *thread) { Thread::Run((Thread *)thread); return null; }
+};
+
+bool Thread::Start(THREADFUNCTION f, void *p)
+{
+  if(handle != null) return false;
+
+  function = f;
+  param = p;
+
+  pthread_t *thread = new pthread_t;
+  if(pthread_create(thread, null, ThreadStart::Run, this) != 0) {
+    delete thread;
+    return false;
+  }
+
+  handle = thread;
+  return true;
+}
+
+void Thread::Join()
+{
+  if(handle == null) return;
+
+  pthread_join(*(pthread_t *)handle, null);
+  delete (pthread_t *)handle;
+  handle = null;
+}
+
+int Thread::GetProcessorCount()
+{
+  return max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+double Clock::GetSeconds()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+#endif
+
+Thread::Thread() : handle(null), function(null), param(null)
+{
+}
+
+Thread::~Thread()
+{
+  Join();
+}
+
+void Thread::Run(Thread *thread)
+{
+  thread->function(thread->param);
+}
+
+//*** ThreadPool
+
+ThreadPool::ThreadPool(int count) : threads(null), threadcount(0), task(null), param(null),
+  count(0), next(0), remaining(0), generation(0), quit(false)
+{
+  if(count <= 0) count = Thread::GetProcessorCount();
+
+  // the calling thread is one of the threads running the tasks
+  threads = new Thread[count - 1];
+  for(int i = 0; i < count - 1; i ++) {
+    if(threads[i].Start(Work, this)) threadcount ++;
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  mutex.Lock();
+  quit = true;
+  start.Broadcast();
+  mutex.Unlock();
+
+  delete[] threads;
+}
+
+void ThreadPool::Work(void *p)
+{
+  ThreadPool *pool = (ThreadPool *)p;
+  int generation = 0;
+
+  pool->mutex.Lock();
+  while(true) {
+    while(!pool->quit && pool->generation == generation)
+      pool->start.Wait(&pool->mutex);
+
+    if(pool->quit) break;
+
+    generation = pool->generation;
+    pool->RunTasks();
+  }
+  pool->mutex.Unlock();
+}
+
+void ThreadPool::RunTasks()
+{
+  while(next < count) {
+    int index = next ++;
+
+    mutex.Unlock();
+    task(param, index, count);
+    mutex.Lock();
+
+    remaining --;
+    if(remaining == 0) done.Broadcast();
+  }
+}
+
+void ThreadPool::Run(TASKFUNCTION t, void *p, int c)
+{
+  if(threadcount == 0 || c <= 1) {
+    for(int i = 0; i < c; i ++)
+      t(p, i, c);
+    return;
+  }
+
+  mutex.Lock();
+  task = t;
+  param = p;
+  count = c;
+  next = 0;
+  remaining = c;
+  generation ++;
+  start.Broadcast();
+
+  RunTasks();
+  while(remaining > 0)
+    done.Wait(&mutex);
+  mutex.Unlock();
+}
+
+//*** MappedFile
+
+MappedFile::MappedFile() : data(null), size(0), writable(false)
+{
+}
+
+MappedFile::~MappedFile()
+{
+  Close();
+}
+
+#ifdef _WIN32
+
+// the view stays valid after the handles of the file and the mapping are closed
+static void* MapFile(HANDLE file, long long size, bool writable)
+{
+  HANDLE mapping = CreateFileMappingA(file, null, writable ? PAGE_READWRITE : PAGE_READONLY,
+    (DWORD)(size >> 32), (DWORD)size, null);
+  if(mapping == null) return null;
+
+  void *data = MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  return data;
+}
+
+bool MappedFile::Open(const char *filename, bool w)
+{
+  Close();
+
+  HANDLE file = CreateFileA(filename, w ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ,
+    null, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, null);
+  if(file == INVALID_HANDLE_VALUE) return false;
+
+  LARGE_INTEGER filesize;
+  if(GetFileSizeEx(file, &filesize) && filesize.QuadPart > 0) {
+    data = MapFile(file, filesize.QuadPart, w);
+    if(data != null) {
+      size = filesize.QuadPart;
+      writable = w;
+    }
+  }
+
+  CloseHandle(file);
+  return data != null;
+}
+
+bool MappedFile::Create(const char *filename, long long s)
+{
+  Close();
+  if(s <= 0) return false;
+
+  HANDLE file = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, 0,
+    null, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, null);
+  if(file == INVALID_HANDLE_VALUE) return false;
+
+  // the mapping extends the file to its size
+  data = MapFile(file, s, true);
+  if(data != null) {
+    size = s;
+    writable = true;
+  }
+
+  CloseHandle(file);
+  return data != null;
+}
+
+void MappedFile::Close()
+{
+  if(data == null) return;
+
+  if(writable)
+    FlushViewOfFile(data, 0);
+  UnmapViewOfFile(data);
+  data = null;
+  size = 0;
+  writable = false;
+}
+
+void MappedFile::Advise(bool sequential)
+{
+  // Windows has no equivalent for an existing view, the cache manager adapts by itself
+}
+
+#else
+
+// the mapping stays valid after the file is closed
+static void* MapFile(int file, long long size, bool writable)
+{
+  void *data = mmap(null, (size_t)size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file, 0);
+  return data == MAP_FAILED ? null : data;
+}
+
+bool MappedFile::Open(const char *filename, bool w)
+{
+  Close();
+
+  int file = open(filename, w ? O_RDWR : O_RDONLY);
+  if(file < 0) return false;
+
+  struct stat info;
+  if(fstat(file, &info) == 0 && info.st_size > 0) {
+    data = MapFile(file, info.st_size, w);
+    if(data != null) {
+      size = info.st_size;
+      writable = w;
+    }
+  }
+
+  close(file);
+  return data != null;
+}
+
+bool MappedFile::Create(const char *filename, long long s)
+{
+  Close();
+  if(s <= 0) return false;
+
+  int file = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(file < 0) return false;
+
+  // the file is extended without writing, the pages are allocated as they are touched
+  if(ftruncate(file, (off_t)s) == 0) {
+    data = MapFile(file, s, true);
+    if(data != null) {
+      size = s;
+      writable = true;
+    }
+  }
+
+  close(file);
+  return data != null;
+}
+
+void MappedFile::Close()
+{
+  if(data == null) return;
+
+  munmap(data, (size_t)size);
+  data = null;
+  size = 0;
+  writable = false;
+}
+
+void MappedFile::Advise(bool sequential)
+{
+  if(data != null)
+    madvise(data, (size_t)size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+}
 
+#endif
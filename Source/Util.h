@@ -85,6 +85,9 @@ protected:
 	Element *elements;
   int size;
 
+  // changes every time an element is attached or detached
+  int version;
+
 public:
 
 	Container();
@@ -95,6 +98,7 @@ public:
 
  
   // returns true if the given element is in this container
+  // this takes constant time since an element can only be in one container
   bool Find(const Element *element);
 
   // returns the index of the element and -1 if the element wasn't found
@@ -127,6 +131,10 @@ public:
   // removes all elements from this container  
   void DetachAll();
 
+  // forgets all elements without detaching or deleting them
+  // only to be used when the memory of the elements is about to be freed all at once
+  void Abandon();
+
   // deletes all elements in this container
   // be careful when using this function
 	void Empty();
@@ -167,32 +175,78 @@ public:
 	~CleanContainer();
 };
 
+// this class is identical to Container, but it also keeps an index of its elements
+// so that Get and GetIndex take constant time
+// the index is rebuilt the first time it's needed after the container has changed
+// note that Get and GetIndex aren't virtual, the container must be accessed as
+// an IndexedContainer (rather than through a Container pointer) to use the index,
+// which is why Layer and NeuralNet return their containers as IndexedContainers
+// rebuilding the index writes to the container, so even Get and GetIndex mustn't be
+// called on the same container by two threads at once after it has changed
+class IndexedContainer : public Container
+{
+protected:
+  // the elements in the order of the linked list
+  Element **index;
+
+  // a hash table of positions in index, -1 marks an empty slot
+  int *table;
+
+  int capacity, tablesize;
+  int indexversion;
+
+  // returns the slot in the hash table where the search for an element starts
+  int Hash(const Element *element);
+
+  // rebuilds the index if the container has changed
+  void UpdateIndex();
+
+public:
+
+  // returns the index of the element and -1 if the element wasn't found
+  int GetIndex(const Element *element);
+
+  // returns the element at the given index
+  Element* Get(int number);
+
+  IndexedContainer();
+  ~IndexedContainer();
+};
+
+// an IndexedContainer that deletes all the elements it contains when destroyed
+class IndexedCleanContainer : public IndexedContainer
+{
+public:
+	~IndexedCleanContainer();
+};
+
 // misc stuff follows
 
 // a memory buffer that expands on demand
 class MemoryBuffer
 {
-  int size;
+  size_t size;
   unsigned char *buffer;
 
 public:
   // returns the size of the buffer in bytes
-  int GetSize();
+  // sizes are size_t, the buffers of large batches may hold more than 2GB
+  size_t GetSize();
 
   // returns a pointer to the buffer bytes
   void* GetBuffer();
 
   // expands the buffer if necessary and returns the pointer to the bytes
-  void* GetBuffer(int bytesize);
+  void* GetBuffer(size_t bytesize);
 
   // reallocates the buffer, that is changes its size (expands or shrinks) while preserving the contents
-  void* Realloc(int bytesize);
+  void* Realloc(size_t bytesize);
 
   // empties the buffer and frees the memory
   void Clear();
 
   MemoryBuffer();
-  MemoryBuffer(int bytesize);
+  MemoryBuffer(size_t bytesize);
 
   ~MemoryBuffer();
 };
@@ -208,9 +262,167 @@ public:
   inline static int GetInt(int max) { return rand() % max; }
   inline static int GetInt() { return rand(); }
 
+  // restarts the sequence of numbers, the same seed always gives the same numbers
+  // the numbers are seeded with the time at startup
+  inline static void Seed(unsigned int seed) { srand(seed); }
+
   Random();
 };
 
+// threads and synchronization, these are thin wrappers around
+// the Windows or POSIX thread functions
+
+// a mutual exclusion lock
+class Mutex
+{
+  void *handle;
+  friend class Condition;
+
+public:
+  void Lock();
+  void Unlock();
+
+  Mutex();
+  ~Mutex();
+};
+
+// a condition variable, always used together with a locked Mutex
+class Condition
+{
+  void *handle;
+
+public:
+  // unlocks the mutex, waits until the condition is signalled and locks the mutex again
+  // the wait may also end without a signal, so the condition has to be checked in a loop
+  void Wait(Mutex *mutex);
+
+  // wakes up one of the waiting threads
+  void Signal();
+
+  // wakes up all of the waiting threads
+  void Broadcast();
+
+  Condition();
+  ~Condition();
+};
+
+typedef void (*THREADFUNCTION)(void *param);
+
+class Thread
+{
+  void *handle;
+
+  THREADFUNCTION function;
+  void *param;
+
+  // the platform specific entry point, calls function(param)
+  static void Run(Thread *thread);
+  friend struct ThreadStart;
+
+public:
+  // starts running function(param) on a new thread
+  // returns false if the thread couldn't be started
+  bool Start(THREADFUNCTION function, void *param);
+
+  // waits for the thread to finish
+  void Join();
+
+  // returns true between Start and Join
+  inline bool IsStarted() { return handle != null; }
+
+  // returns the number of processors in the system
+  static int GetProcessorCount();
+
+  Thread();
+
+  // joins the thread if it's still running
+  ~Thread();
+};
+
+// a clock for measuring how long things take
+class Clock
+{
+public:
+  // returns the time in seconds since some fixed point in the past
+  static double GetSeconds();
+};
+
+// a task run by a ThreadPool, index goes from 0 to count - 1
+typedef void (*TASKFUNCTION)(void *param, int index, int count);
+
+// a pool of threads which run tasks in parallel
+// Run shouldn't be called from several threads at once, or from within a task
+class ThreadPool
+{
+  Thread *threads;
+  int threadcount;
+
+  Mutex mutex;
+  Condition start, done;
+
+  // the tasks being run
+  TASKFUNCTION task;
+  void *param;
+  int count, next, remaining;
+
+  // changes every time Run is called, so that the threads know there are new tasks
+  int generation;
+  bool quit;
+
+  // the loop run by each thread
+  static void Work(void *pool);
+
+  // runs tasks until there are none left, the mutex must be locked
+  void RunTasks();
+
+public:
+
+  // calls task(param, index, count) for every index from 0 to count - 1
+  // the calls are spread over the threads of the pool and the calling thread
+  // returns once all of them have finished, so it also acts as a barrier
+  void Run(TASKFUNCTION task, void *param, int count);
+
+  // returns the number of threads running tasks, including the calling thread
+  inline int GetThreadCount() { return threadcount + 1; }
+
+  // creates a pool with the given number of threads, including the calling thread
+  // 0 creates one thread for every processor
+  ThreadPool(int threadcount = 0);
+  ~ThreadPool();
+};
+
+// a file mapped into memory, its pages are read when they are first touched
+// and may be dropped again by the system when memory runs low, so a file
+// can be used as if it were in memory even when it's larger than the memory
+class MappedFile
+{
+  void *data;
+  long long size;
+  bool writable;
+
+public:
+  // maps an existing file, for reading only unless writable is true
+  bool Open(const char *filename, bool writable = false);
+
+  // creates a file of size bytes, which are 0, and maps it for writing
+  // an existing file is overwritten
+  bool Create(const char *filename, long long size);
+
+  // unmaps the file, the changes made to a writable file are saved
+  void Close();
+
+  // tells the system whether the file is going to be read in order or at random
+  // which changes how far it reads ahead
+  void Advise(bool sequential);
+
+  inline void* GetData() { return data; }
+  inline long long GetSize() { return size; }
+  inline bool IsOpen() { return data != null; }
+
+  MappedFile();
+  ~MappedFile();
+};
+
 // some commonly used macros
 
 #ifndef max